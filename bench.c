@@ -0,0 +1,195 @@
+// 比较几种用法的ops/sec: SQL 文本(db_exec)、prepare 一次后绑定参数执行、
+// 直接接口(db_put/db_get/db_scan)、按批读写(db_put_batch/db_multi_get)
+//   gcc -O2 -c -DDB_LIBRARY part8.c -o db.o
+//   gcc -O2 bench.c db.o -o bench -lpthread
+//   ./bench [rows] [rounds]
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+
+#define BENCH_FILE "bench.db"
+
+typedef enum { BENCH_PUT, BENCH_GET, BENCH_SCAN } BenchOp;
+typedef enum { MODE_TEXT, MODE_PREPARED, MODE_API, MODE_BATCH } BenchMode;
+
+// db_put_batch/db_multi_get 每批的行数
+#define BENCH_BATCH 64
+
+double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+bool count_row(void* arg, const DBRowView* row) {
+  (*(uint32_t*)arg)++;
+  return true;
+}
+// 打乱插入顺序，各种用法用同一个顺序
+void shuffle(uint32_t* ids, uint32_t rows) {
+  for (uint32_t i = rows - 1; i > 0; i--) {
+    uint32_t j = rand() % (i + 1);
+    uint32_t id = ids[i];
+    ids[i] = ids[j];
+    ids[j] = id;
+  }
+}
+DBResult bench_put(BenchMode mode, DB* db, DBStatement* statement,
+                   uint32_t id) {
+  char sql[128];
+  char username[DB_COLUMN_USERNAME + 1];
+  char email[DB_COLUMN_EMAIL + 1];
+  if (mode == MODE_TEXT) {
+    snprintf(sql, sizeof(sql), "insert %u user%u user%u@example.com", id, id,
+             id);
+    return db_exec(db, sql, NULL, NULL);
+  }
+  snprintf(username, sizeof(username), "user%u", id);
+  snprintf(email, sizeof(email), "user%u@example.com", id);
+  if (mode == MODE_API) {
+    return db_put(db, id, username, email);
+  }
+  db_bind_int(statement, 1, id);
+  db_bind_text(statement, 2, username);
+  db_bind_text(statement, 3, email);
+  return db_execute(db, statement, NULL, NULL);
+}
+uint32_t bench_get(BenchMode mode, DB* db, DBStatement* statement,
+                   uint32_t id) {
+  char sql[128];
+  uint32_t found = 0;
+  if (mode == MODE_TEXT) {
+    snprintf(sql, sizeof(sql), "select where id = %u", id);
+    db_exec(db, sql, count_row, &found);
+  } else if (mode == MODE_PREPARED) {
+    db_bind_int(statement, 1, id);
+    db_execute(db, statement, count_row, &found);
+  } else {
+    DBRow row;
+    found = db_get(db, id, &row);
+  }
+  return found;
+}
+// 打乱顺序的ids 每BENCH_BATCH 个一批插入
+void bench_put_batch(DB* db, uint32_t* ids, uint32_t rows) {
+  DBRow batch[BENCH_BATCH];
+  for (uint32_t i = 0; i < rows; i += BENCH_BATCH) {
+    uint32_t n = rows - i < BENCH_BATCH ? rows - i : BENCH_BATCH;
+    for (uint32_t j = 0; j < n; j++) {
+      batch[j].id = ids[i + j];
+      snprintf(batch[j].username, sizeof(batch[j].username), "user%u",
+               ids[i + j]);
+      snprintf(batch[j].email, sizeof(batch[j].email), "user%u@example.com",
+               ids[i + j]);
+    }
+    DBResult result = db_put_batch(db, batch, n, NULL);
+    if (result != DB_OK) {
+      printf("bench batch insert at %u failed: %d.\n", i, result);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+// 打乱顺序的ids 每BENCH_BATCH 个一批读回，返回找到的行数
+uint32_t bench_get_batch(DB* db, uint32_t* ids, uint32_t rows) {
+  DBRow batch[BENCH_BATCH];
+  uint32_t found = 0;
+  for (uint32_t i = 0; i < rows; i += BENCH_BATCH) {
+    uint32_t n = rows - i < BENCH_BATCH ? rows - i : BENCH_BATCH;
+    found += db_multi_get(db, ids + i, n, batch, NULL);
+  }
+  return found;
+}
+// 一轮: 新建表，插入rows 行，逐个读回，再整表扫描一次
+// elapsed 累加每种操作的耗时，不含打开/关闭文件
+void bench_round(BenchMode mode, uint32_t* ids, uint32_t rows,
+                 double* elapsed) {
+  unlink(BENCH_FILE);
+  DB* db = db_open(BENCH_FILE);
+  DBStatement* statement = NULL;
+
+  double start = now_seconds();
+  if (mode == MODE_PREPARED) {
+    db_prepare(db, "insert ? ? ?", &statement);
+  }
+  if (mode == MODE_BATCH) {
+    bench_put_batch(db, ids, rows);
+  }
+  for (uint32_t i = 0; mode != MODE_BATCH && i < rows; i++) {
+    DBResult result = bench_put(mode, db, statement, ids[i]);
+    if (result != DB_OK) {
+      printf("bench insert %u failed: %d.\n", ids[i], result);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (statement) {
+    db_finalize(statement);
+  }
+  elapsed[BENCH_PUT] += now_seconds() - start;
+
+  start = now_seconds();
+  if (mode == MODE_PREPARED) {
+    db_prepare(db, "select where id = ?", &statement);
+  }
+  uint32_t found = 0;
+  if (mode == MODE_BATCH) {
+    found = bench_get_batch(db, ids, rows);
+  }
+  for (uint32_t i = 0; mode != MODE_BATCH && i < rows; i++) {
+    found += bench_get(mode, db, statement, ids[i]);
+  }
+  if (statement) {
+    db_finalize(statement);
+  }
+  elapsed[BENCH_GET] += now_seconds() - start;
+
+  start = now_seconds();
+  uint32_t scanned = 0;
+  if (mode >= MODE_API) {
+    db_scan(db, 0, UINT32_MAX, count_row, &scanned);
+  } else {
+    db_exec(db, "select", count_row, &scanned);
+  }
+  elapsed[BENCH_SCAN] += now_seconds() - start;
+  if (found != rows || scanned != rows) {
+    printf("bench read back %u/%u rows, expect %u.\n", found, scanned, rows);
+    exit(EXIT_FAILURE);
+  }
+  db_close(db);
+}
+
+int main(int argc, char** argv) {
+  // 内部节点不分裂，行数受根节点容量限制
+  uint32_t rows = argc > 1 ? atoi(argv[1]) : 500;
+  uint32_t rounds = argc > 2 ? atoi(argv[2]) : 200;
+  uint32_t* ids = malloc(rows * sizeof(uint32_t));
+  for (uint32_t i = 0; i < rows; i++) {
+    ids[i] = i + 1;
+  }
+  srand(1);
+  shuffle(ids, rows);
+
+  double elapsed[4][3] = {{0}};
+  for (uint32_t round = 0; round < rounds; round++) {
+    for (int mode = MODE_TEXT; mode <= MODE_BATCH; mode++) {
+      bench_round(mode, ids, rows, elapsed[mode]);
+    }
+  }
+  unlink(BENCH_FILE);
+
+  double ops = (double)rows * rounds;
+  printf("%-6s %14s %14s %14s %14s %8s\n", "op", "text ops/s",
+         "prepared ops/s", "api ops/s", "batch ops/s", "speedup");
+  char* names[] = {"put", "get", "scan"};
+  for (int op = BENCH_PUT; op <= BENCH_SCAN; op++) {
+    double text_ops = ops / elapsed[MODE_TEXT][op];
+    double prepared_ops = ops / elapsed[MODE_PREPARED][op];
+    double api_ops = ops / elapsed[MODE_API][op];
+    double batch_ops = ops / elapsed[MODE_BATCH][op];
+    printf("%-6s %14.0f %14.0f %14.0f %14.0f %7.2fx\n", names[op], text_ops,
+           prepared_ops, api_ops, batch_ops, api_ops / text_ops);
+  }
+  free(ids);
+  return 0;
+}
@@ -0,0 +1,240 @@
+// 基准测试套件: 顺序插入、随机插入、点查(热/冷)、范围扫描、全表扫描
+// 每项给出ops/s、p50/p99/p999 延迟、读入的页数、缓存的页数和文件大小，整体输出为JSON
+// 方便保存下来比较回归
+//   gcc -O2 -c -DDB_LIBRARY part8.c -o db.o
+//   gcc -O2 bench_suite.c db.o -o bench_suite -lpthread
+//   ./bench_suite [rows ...] > result.json
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+
+#define SUITE_FILE "bench_suite.db"
+
+// 内部节点不分裂，表最多100页，行数超过时按这个上限测
+#define SUITE_MAX_ROWS 600
+// 热点查的次数、范围扫描的次数和每次的宽度、全表扫描的次数
+#define SUITE_LOOKUPS 100000
+#define SUITE_SCANS 10000
+#define SUITE_SCAN_WIDTH 100
+#define SUITE_FULL_SCANS 1000
+
+// 一项测试的结果，latencies 为每次操作的纳秒数
+typedef struct {
+  const char* name;
+  uint32_t ops;
+  uint64_t* latencies;
+  uint64_t elapsed;
+  // 扫描输出的行数，点查找到的行数
+  uint64_t rows;
+  uint64_t pages_read;
+  // 测完时内存中的页数，不区分是否修改过: 只读的测试也包括读进来的所有页面
+  uint32_t pages_cached;
+  uint64_t file_bytes;
+} SuiteResult;
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+bool count_row(void* arg, const DBRowView* row) {
+  (*(uint64_t*)arg)++;
+  return true;
+}
+void shuffle(uint32_t* ids, uint32_t rows) {
+  for (uint32_t i = rows - 1; i > 0; i--) {
+    uint32_t j = rand() % (i + 1);
+    uint32_t id = ids[i];
+    ids[i] = ids[j];
+    ids[j] = id;
+  }
+}
+int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+void result_begin(SuiteResult* result, const char* name, uint32_t ops) {
+  memset(result, 0, sizeof(SuiteResult));
+  result->name = name;
+  result->ops = ops;
+  result->latencies = malloc(ops * sizeof(uint64_t));
+}
+// 测完关闭表
+void result_end(SuiteResult* result, DB* db, uint64_t pages_read_before) {
+  DBStats stats;
+  db_stats(db, &stats);
+  result->pages_read = stats.pages_read - pages_read_before;
+  result->pages_cached = stats.pages_cached;
+  db_close(db);
+  struct stat st;
+  result->file_bytes = stat(SUITE_FILE, &st) == 0 ? st.st_size : 0;
+}
+uint64_t percentile(uint64_t* sorted, uint32_t n, double p) {
+  return sorted[(uint32_t)(p * (n - 1))];
+}
+void result_print(SuiteResult* result, bool last) {
+  qsort(result->latencies, result->ops, sizeof(uint64_t), compare_u64);
+  uint64_t* lat = result->latencies;
+  uint32_t n = result->ops;
+  printf("        {\"name\": \"%s\", \"ops\": %u, \"ops_per_sec\": %.0f, "
+         "\"rows\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+         "\"p999_ns\": %llu, \"pages_read\": %llu, \"pages_cached\": %u, "
+         "\"file_bytes\": %llu}%s\n",
+         result->name, n, n / (result->elapsed / 1e9),
+         (unsigned long long)result->rows,
+         (unsigned long long)percentile(lat, n, 0.5),
+         (unsigned long long)percentile(lat, n, 0.99),
+         (unsigned long long)percentile(lat, n, 0.999),
+         (unsigned long long)result->pages_read, result->pages_cached,
+         (unsigned long long)result->file_bytes, last ? "" : ",");
+  free(result->latencies);
+}
+
+// 插入ids 中的rows 行，新建表
+void suite_insert(SuiteResult* result, const char* name, uint32_t* ids,
+                  uint32_t rows) {
+  unlink(SUITE_FILE);
+  DB* db = db_open(SUITE_FILE);
+  result_begin(result, name, rows);
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < rows; i++) {
+    char username[DB_COLUMN_USERNAME + 1];
+    char email[DB_COLUMN_EMAIL + 1];
+    snprintf(username, sizeof(username), "user%u", ids[i]);
+    snprintf(email, sizeof(email), "user%u@example.com", ids[i]);
+    uint64_t t = now_ns();
+    if (db_put(db, ids[i], username, email) != DB_OK) {
+      fprintf(stderr, "insert %u failed.\n", ids[i]);
+      exit(EXIT_FAILURE);
+    }
+    result->latencies[i] = now_ns() - t;
+  }
+  result->elapsed = now_ns() - start;
+  result_end(result, db, 0);
+}
+// 系统缓存中去掉表文件，之后打开表的第一次访问都要读磁盘
+void suite_evict() {
+  int fd = open(SUITE_FILE, O_RDONLY);
+  if (fd == -1) {
+    return;
+  }
+  fdatasync(fd);
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+  close(fd);
+}
+// 打开已有的表; warm 时先整表扫描一次把页面读进内存
+DB* suite_open(bool warm, uint64_t* pages_read) {
+  DB* db = db_open(SUITE_FILE);
+  if (warm) {
+    uint64_t scanned = 0;
+    db_scan(db, 0, UINT32_MAX, count_row, &scanned);
+  }
+  DBStats stats;
+  db_stats(db, &stats);
+  *pages_read = stats.pages_read;
+  return db;
+}
+// 热点查: 页面都在内存中，随机id; 冷点查: 清掉系统缓存后重新打开，每个id 查一次
+void suite_lookup(SuiteResult* result, uint32_t* ids, uint32_t rows,
+                  bool cold) {
+  uint32_t ops = cold ? rows : SUITE_LOOKUPS;
+  if (cold) {
+    suite_evict();
+  }
+  uint64_t pages_read;
+  DB* db = suite_open(!cold, &pages_read);
+  result_begin(result, cold ? "point_lookup_cold" : "point_lookup_hot", ops);
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < ops; i++) {
+    uint32_t id = cold ? ids[i] : rand() % rows + 1;
+    DBRow row;
+    uint64_t t = now_ns();
+    result->rows += db_get(db, id, &row);
+    result->latencies[i] = now_ns() - t;
+  }
+  result->elapsed = now_ns() - start;
+  result_end(result, db, pages_read);
+}
+// 范围扫描每次SUITE_SCAN_WIDTH 个id，全表扫描每次整表
+void suite_scan(SuiteResult* result, uint32_t rows, bool full) {
+  uint32_t ops = full ? SUITE_FULL_SCANS : SUITE_SCANS;
+  uint64_t pages_read;
+  DB* db = suite_open(true, &pages_read);
+  result_begin(result, full ? "full_scan" : "range_scan", ops);
+  uint64_t start = now_ns();
+  for (uint32_t i = 0; i < ops; i++) {
+    uint32_t lo = full ? 0 : rand() % rows + 1;
+    uint32_t hi = full ? UINT32_MAX : lo + SUITE_SCAN_WIDTH - 1;
+    uint64_t t = now_ns();
+    db_scan(db, lo, hi, count_row, &result->rows);
+    result->latencies[i] = now_ns() - t;
+  }
+  result->elapsed = now_ns() - start;
+  result_end(result, db, pages_read);
+}
+// 一个表大小上跑完所有测试
+void suite_run(uint32_t rows, uint32_t requested, bool last) {
+  uint32_t* ids = malloc(rows * sizeof(uint32_t));
+  for (uint32_t i = 0; i < rows; i++) {
+    ids[i] = i + 1;
+  }
+  SuiteResult results[6];
+  suite_insert(&results[0], "seq_insert", ids, rows);
+  shuffle(ids, rows);
+  suite_insert(&results[1], "random_insert", ids, rows);
+  suite_lookup(&results[2], ids, rows, false);
+  shuffle(ids, rows);
+  suite_lookup(&results[3], ids, rows, true);
+  suite_scan(&results[4], rows, false);
+  suite_scan(&results[5], rows, true);
+  unlink(SUITE_FILE);
+  free(ids);
+
+  printf("    {\"rows\": %u, \"requested_rows\": %u, \"workloads\": [\n", rows,
+         requested);
+  for (int i = 0; i < 6; i++) {
+    result_print(&results[i], i == 5);
+  }
+  printf("    ]}%s\n", last ? "" : ",");
+}
+
+int main(int argc, char** argv) {
+  uint32_t defaults[] = {10000, 100000, 1000000, 10000000, 100000000};
+  uint32_t num_sizes = argc > 1 ? argc - 1 : 5;
+  // 超过上限的大小按上限测，测出来相同的只跑一次
+  uint32_t* rows = malloc(num_sizes * sizeof(uint32_t));
+  uint32_t* requested = malloc(num_sizes * sizeof(uint32_t));
+  uint32_t num_runs = 0;
+  for (uint32_t i = 0; i < num_sizes; i++) {
+    uint32_t size = argc > 1 ? strtoul(argv[i + 1], NULL, 10) : defaults[i];
+    uint32_t clamped = size < SUITE_MAX_ROWS ? size : SUITE_MAX_ROWS;
+    bool seen = clamped == 0;
+    for (uint32_t j = 0; j < num_runs; j++) {
+      seen = seen || rows[j] == clamped;
+    }
+    if (!seen) {
+      rows[num_runs] = clamped;
+      requested[num_runs++] = size;
+    }
+  }
+  srand(1);
+  printf("{\n  \"page_size\": 4096,\n  \"max_rows\": %u,\n  \"runs\": [\n",
+         SUITE_MAX_ROWS);
+  for (uint32_t i = 0; i < num_runs; i++) {
+    suite_run(rows[i], requested[i], i == num_runs - 1);
+  }
+  printf("  ]\n}\n");
+  free(rows);
+  free(requested);
+  return 0;
+}
@@ -0,0 +1,129 @@
+#ifndef DB_H
+#define DB_H
+// 嵌入使用的接口，实现在part8.c
+// 作为库编译时定义DB_LIBRARY 去掉REPL 的main:
+//   gcc -c -DDB_LIBRARY part8.c -o db.o
+#include <stdbool.h>
+#include <stdint.h>
+
+// username/email 的最大长度(不含'\0')
+#define DB_COLUMN_USERNAME 32
+#define DB_COLUMN_EMAIL 255
+
+typedef struct {
+  uint32_t id;
+  char username[DB_COLUMN_USERNAME + 1];
+  char email[DB_COLUMN_EMAIL + 1];
+} DBRow;
+
+// select 结果中的一行: 字符串直接指向页面，只在回调期间有效，没有选择的列为NULL
+// count/min/max/rank 的结果放在id 中，每个值回调一次
+typedef struct {
+  uint32_t id;
+  const char* username;
+  const char* email;
+} DBRowView;
+// 返回false 表示不再需要后面的行
+// select unordered 在并行扫描时由扫描线程调用(调用之间互斥)
+typedef bool (*DBRowCallback)(void* arg, const DBRowView* row);
+// db_import 拒绝的行: line 是文件中的行号(从1开始)
+typedef void (*DBRejectCallback)(void* arg, uint32_t line, const char* reason);
+
+typedef enum {
+  DB_OK,
+  DB_DUPLICATE_KEY,
+  DB_NOT_FOUND,
+  DB_DUPLICATE_INDEX,
+  // 表的页面用完，这一行(批量写入时是放不下的那些行)没有写入，表保持不变
+  DB_FULL_TABLE,
+  DB_SYNTAX_ERROR,
+  DB_STRING_TOO_LONG,
+  DB_NEGATIVE_ID,
+  DB_UNRECOGNIZED_STATEMENT,
+  // 参数序号或类型不对，或者执行时还有参数未绑定
+  DB_PARAMETER_ERROR,
+  // 打开或映射文件失败，errno 给出原因
+  DB_IO_ERROR
+} DBResult;
+
+// 页面统计，db_stats 取得
+typedef struct {
+  // 打开以来从文件读入的页数
+  uint64_t pages_read;
+  // 当前在内存中的页数，db_close 时全部写回文件
+  uint32_t pages_cached;
+  // 表占用的页数
+  uint32_t num_pages;
+  // 最近结束的一次全表扫描访问的叶子数和被zone map 跳过的叶子数
+  uint32_t scan_leaves;
+  uint32_t scan_skipped_leaves;
+  // 按SQL 文本缓存的解析结果命中和未命中的次数
+  uint32_t plan_cache_hits;
+  uint32_t plan_cache_misses;
+} DBStats;
+
+typedef struct Table DB;
+typedef struct Statement DBStatement;
+
+DB* db_open(const char* filename);
+void db_close(DB* db);
+
+// 不经过SQL 文本的单行操作，直接按类型传值
+DBResult db_put(DB* db, uint32_t id, const char* username, const char* email);
+// 与insert or replace 相同: id 已存在时整行覆盖，不存在时插入，只下降一次
+DBResult db_upsert(DB* db, uint32_t id, const char* username,
+                   const char* email);
+// 一批行在一个事务中插入: 按id 排序后，落在同一个叶子上的行只下降一次
+// 与表中或批中靠前的行重复的跳过，其余照常插入，有跳过时返回DB_DUPLICATE_KEY
+// 表满时放不下的行不插入，返回DB_FULL_TABLE
+// results 不为NULL 时按rows 的顺序给出每行的结果
+DBResult db_put_batch(DB* db, const DBRow* rows, uint32_t num_rows,
+                      DBResult* results);
+bool db_get(DB* db, uint32_t id, DBRow* row);
+// 一次查多个id: 排序后最多32 个查找交错下降并预取下一层节点，结果按ids 的顺序写入rows
+// 页面不在内存中时先提交预读去推进其他查找，全部都在等磁盘时才阻塞
+// found 不为NULL 时记录每个id 是否存在，返回找到的行数
+// 每个id 的可见性与db_get 相同，不保证所有行来自同一时刻
+uint32_t db_multi_get(DB* db, const uint32_t* ids, uint32_t num_ids,
+                      DBRow* rows, bool* found);
+DBResult db_delete(DB* db, uint32_t id);
+void db_stats(DB* db, DBStats* stats);
+// 全表扫描、建索引和导入使用的线程数，默认1，0 按1 处理
+// 之后执行的已准备语句重新选择访问路径
+void db_set_threads(DB* db, uint32_t threads);
+// 导入csv(delimiter 为',')或tsv('\t') 文件: 每行id,username,email
+// 按线程数切块并行解析，按id 排序后分批插入; 第一行id 不是数字时当作表头跳过
+// imported/rejected 给出插入和拒绝的行数，前10 个被拒绝的行调用on_reject
+DBResult db_import(DB* db, const char* filename, char delimiter,
+                   uint32_t* imported, uint32_t* rejected,
+                   DBRejectCallback on_reject, void* arg);
+// 按id 顺序输出id 在[lo, hi] 内的行
+void db_scan(DB* db, uint32_t lo, uint32_t hi, DBRowCallback callback,
+             void* arg);
+
+// 显式事务: 之间的语句共用一个事务号，db_commit 之后其他读者才能看到
+// 事务期间调用线程一直持有写锁，其他线程的写语句等待; 不支持回滚
+// 不支持嵌套: 事务中再调用db_begin 什么也不做，由第一个db_commit 提交
+// 调用线程没有开始事务时db_commit 什么也不做
+void db_begin(DB* db);
+void db_commit(DB* db);
+
+// 解析一次、执行多次; callback 为NULL 时按REPL 的格式打印到stdout
+// 解析结果和访问路径按SQL 文本缓存，相同文本的prepare 不再解析
+// 多行插入: insert values (id, username, email), (...) 与db_put_batch 相同
+// 多点查: select where id in (1, 2, ...) 与db_multi_get 相同，按列表顺序输出
+// insert or replace id username email: 存在就覆盖，不存在就插入
+// update set username = x, email = y where id = z: 只改列出的列
+// 值可以写成? 再绑定: insert ? ? ?、update set email = ? where id = ?、
+// select where id = ?、where username like ?、limit ? offset ?、delete ?
+DBResult db_prepare(DB* db, const char* sql, DBStatement** statement);
+// 绑定第index 个?(从1开始)，绑定的值在多次执行间保持
+DBResult db_bind_int(DBStatement* statement, uint32_t index, uint32_t value);
+DBResult db_bind_text(DBStatement* statement, uint32_t index,
+                      const char* value);
+DBResult db_execute(DB* db, DBStatement* statement, DBRowCallback callback,
+                    void* arg);
+void db_finalize(DBStatement* statement);
+DBResult db_exec(DB* db, const char* sql, DBRowCallback callback, void* arg);
+
+#endif
@@ -1,3 +1,5 @@
+// preadv2/RWF_NOWAIT
+#define _GNU_SOURCE
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -5,7 +7,22 @@
 #include <string.h>
 // open
 #include <fcntl.h>
+#include <sys/uio.h>
 #include <unistd.h>
+// .import 映射文件
+#include <sys/mman.h>
+#include <sys/stat.h>
+// 并发读写
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "db.h"
 
 // 对第一个字符为 '.' 原始输入命令的解析
 typedef enum {
@@ -25,12 +42,22 @@ typedef enum {
 } PrepareResult;
 
 // 操作类型
-typedef enum { STATEMENT_INSERT, STATEMENT_SELECT } StatementType;
+typedef enum {
+  STATEMENT_INSERT,
+  STATEMENT_SELECT,
+  STATEMENT_UPDATE,
+  // insert or replace
+  STATEMENT_UPSERT,
+  STATEMENT_DELETE,
+  STATEMENT_CREATE_INDEX
+} StatementType;
 
 // 执行结果状态码
 typedef enum {
   EXECUTE_SUCCESS,
   EXECUTE_DUPLICATE_KEY,
+  EXECUTE_NOT_FOUND,
+  EXECUTE_DUPLICATE_INDEX,
   EXECUTE_FULL_TABLE
 } ExecuteResult;
 
@@ -39,7 +66,8 @@ typedef enum { NODE_INTERNAL, NODE_LEAF } NodeType;
 // 输入原文的结构
 typedef struct {
   char* buffer;
-  uint32_t buffer_length;
+  // getline 分配的大小，整个会话重复使用
+  size_t buffer_length;
   uint32_t str_length;
 } InputBuffer;
 
@@ -56,22 +84,122 @@ void del_input_buffer(InputBuffer* input_buffer) {
 }
 
 // 指明username 大小为32字节
-const uint32_t COLUMN_USERNAME = 32;
+const uint32_t COLUMN_USERNAME = DB_COLUMN_USERNAME;
 // 指明email 大小为255字节
-const uint32_t COLUMN_EMAIL = 255;
+const uint32_t COLUMN_EMAIL = DB_COLUMN_EMAIL;
 
 // Row 代表写入的表类型结构 |id(4)|username(33)|email(256)|
-typedef struct {
-  uint32_t id;
-  // +1 是为了给'\0'保留一位，下同
-  char username[COLUMN_USERNAME + 1];
-  char email[COLUMN_EMAIL + 1];
-} Row;
+// 定义在db.h，username/email 各+1 是为了给'\0'保留一位
+typedef DBRow Row;
+
+// select 输出的列，按位组合成扫描需要读取的列
+typedef enum {
+  PROJECTION_ID = 1 << 0,
+  PROJECTION_USERNAME = 1 << 1,
+  PROJECTION_EMAIL = 1 << 2
+} Projection;
+
+// select 的聚合，由树上的元数据直接得出
+typedef enum {
+  AGGREGATE_COUNT,
+  AGGREGATE_MIN,
+  AGGREGATE_MAX
+} Aggregate;
+
+// select 对username/email 的过滤条件
+typedef enum {
+  FILTER_NONE,
+  // = 'x' 或like 'x'
+  FILTER_EQUAL,
+  // like 'x%'
+  FILTER_PREFIX,
+  // like '%x'
+  FILTER_SUFFIX,
+  // like '%x%'
+  FILTER_CONTAINS
+} FilterOp;
+
+// prepare 时为select 选定的访问路径，随Statement 一起缓存
+typedef enum {
+  // 按叶子顺序扫描，有offset 时先按子树计数定位
+  PLAN_SCAN,
+  // where id = x 点查
+  PLAN_POINT,
+  // where id in (...) 多点查，按列表顺序输出
+  PLAN_MULTI_POINT,
+  // 按username/email 索引查找
+  PLAN_INDEX,
+  // 多线程分区扫描
+  PLAN_PARALLEL,
+  // count/min/max 和rank 由子树计数得到
+  PLAN_COUNT
+} Plan;
+
+// ? 参数绑定到的字段
+typedef enum {
+  PARAM_ROW_ID,
+  PARAM_USERNAME,
+  PARAM_EMAIL,
+  PARAM_SELECT_ID,
+  PARAM_FILTER,
+  PARAM_LIMIT,
+  PARAM_OFFSET
+} ParamSlot;
 
 // Statement 对象为操作对象
-typedef struct {
+typedef struct Statement {
   StatementType type;
+  // insert/update 的行，delete 只用到id
   Row row_to_insert;
+  // update 要写的列(PROJECTION_USERNAME/EMAIL)，没有列出的列保留旧值
+  uint32_t update_columns;
+  // insert values (...), (...) 的多行或where id in (...) 的id 列表:
+  // 文本和个数，执行时再解析; db_prepare 时文本复制到Statement 后面
+  const char* values;
+  uint32_t values_length;
+  uint32_t num_values;
+  // select where id = x 点查
+  bool select_by_id;
+  uint32_t id_to_select;
+  // 并行扫描时不要求按key 顺序输出
+  bool unordered;
+  // select 的列: columns 为输出顺序，projection 为需要读取的列
+  Projection columns[3];
+  uint32_t num_columns;
+  uint32_t projection;
+  // count(*)/min(id)/max(id)，与普通列互斥
+  Aggregate aggregates[3];
+  uint32_t num_aggregates;
+  // select rank where id = x: 输出x 按id 排序的位置(从1开始)
+  bool rank;
+  // limit/offset，没有limit 时为UINT32_MAX
+  uint32_t limit;
+  uint32_t offset;
+  // where username/email 谓词，pattern 已去掉引号和%
+  FilterOp filter_op;
+  Projection filter_column;
+  char filter_pattern[COLUMN_EMAIL + 1];
+  uint32_t filter_length;
+  // like ? 绑定后才知道FilterOp
+  bool filter_like;
+  // 按叶子zone map 跳过叶子: username 前缀范围[zone_lo, zone_hi]，email 域名bloom 位
+  bool zone_by_username;
+  char zone_lo[8];
+  char zone_hi[8];
+  uint64_t zone_bloom;
+  // create index on username/email
+  Projection index_column;
+  // select 结果交给callback，为NULL 时打印; callback 返回false 后stopped 置位
+  DBRowCallback callback;
+  void* callback_arg;
+  bool stopped;
+  // ? 参数依次对应的字段(一条语句最多3个)，bound 按位记录已绑定的参数
+  ParamSlot params[3];
+  uint32_t num_params;
+  uint32_t bound;
+  // 访问路径和选择时表的plan_version，不一致时执行前重新选择
+  Plan plan;
+  uint32_t plan_version;
 } Statement;
 
 // 便捷宏
@@ -94,21 +222,122 @@ const uint32_t ROW_SIZE =
 const uint32_t PAGE_SIZE = 4096;
 const uint32_t TABLE_MAX_PAGES = 100; // 模拟有100页
 
+// 写时复制被替换下来的旧页面缓冲
+typedef struct RetiredPage {
+  void* page;
+  // 被替换时的纪元，只有更早的快照还会读到它
+  uint64_t retired_epoch;
+  // 被替换时的读阶段，更早进入的乐观读者还可能读到它
+  uint32_t retired_phase;
+  struct RetiredPage* next;
+} RetiredPage;
+
 // 页面属性
 typedef struct {
-  void* pages[TABLE_MAX_PAGES];
+  // 读者不加锁读取，缺页读入和写时复制换入新缓冲都用release 发布
+  _Atomic(void*) pages[TABLE_MAX_PAGES];
   int file_descriptor;
   int file_length;
   // 记录页面数量
   uint32_t num_pages;
+  // 每页的版本号(乐观锁): 写者修改前后各加1，奇数表示正在被修改
+  _Atomic uint64_t page_versions[TABLE_MAX_PAGES];
+  // 当前写语句已加锁的页面，语句结束时统一解锁
+  uint32_t write_set[TABLE_MAX_PAGES];
+  uint32_t write_set_size;
+  // 保护从磁盘加载页面
+  pthread_mutex_t load_lock;
+  // 写时复制: 每个页面缓冲生成时的纪元，每次获取快照后纪元加1
+  uint64_t page_epochs[TABLE_MAX_PAGES];
+  uint64_t epoch;
+  // 最新、最老活跃快照的纪元，不大于cow_epoch 的页面被修改前要先复制
+  // 0表示没有快照
+  uint64_t cow_epoch;
+  uint64_t oldest_epoch;
+  RetiredPage* retired_pages;
+  // 乐观读者不pin 页面，按进入时的阶段计数，旧缓冲等这些读者离开后才释放
+  // 活跃读者只可能在当前阶段和上一阶段
+  _Atomic uint32_t read_phase;
+  _Atomic uint32_t phase_readers[2];
+  // 打开以来从文件读入的页数，在load_lock 下累加
+  uint64_t pages_read;
 } Pager;
 
-// Table属性
+// MVCC 事务号: 0 表示xmax 未设置(未删除)
+// 1 表示之前会话已提交并冻结的事务，对所有读者都已提交
+const uint32_t TXN_NONE = 0;
+const uint32_t TXN_FROZEN = 1;
+// 叶子满了而旧版本只被开着的读视图挡住时，写者等视图关闭的最长毫秒数
+const uint32_t GC_WAIT_MS = 50;
+
+// 读视图: 只能看到txn_id 及之前提交的版本
+typedef struct ReadView {
+  uint32_t txn_id;
+  struct ReadView* next;
+} ReadView;
+
+// 建索引期间写者写入的(value, id) key，按到达顺序追加
+typedef struct {
+  bool building;
+  char* keys;
+  uint32_t num_keys;
+  uint32_t capacity;
+} IndexCatchUp;
+
+// 按SQL 文本缓存解析好、选好访问路径的Statement，按文本hash 直接映射
+// 超过PLAN_CACHE_SQL_SIZE 的文本不缓存
+const uint32_t PLAN_CACHE_SIZE = 64;
+const uint32_t PLAN_CACHE_SQL_SIZE = 128;
 typedef struct {
+  char sql[PLAN_CACHE_SIZE][PLAN_CACHE_SQL_SIZE];
+  Statement statements[PLAN_CACHE_SIZE];
+  uint32_t hits;
+  uint32_t misses;
+  pthread_mutex_t lock;
+} PlanCache;
+
+// Table属性
+typedef struct Table {
   // 保存页面数据，方便上下文获取
   Pager* pager;
   // 记录root页面坐标
   uint32_t root_page_num;
+  // 写者之间互斥，读者不加锁
+  pthread_mutex_t write_lock;
+  // 快照: parent 指向源表，pager 是获取快照时页表的只读拷贝
+  struct Table* parent;
+  uint64_t snapshot_epoch;
+  // 源表上活跃快照链表
+  struct Table* snapshots;
+  struct Table* next_snapshot;
+  // MVCC: 下一个写事务号、最新已提交事务号、当前写事务号(持有write_lock 时有效)
+  uint32_t next_txn_id;
+  _Atomic uint32_t committed_txn_id;
+  uint32_t write_txn_id;
+  // 显式事务(db_begin 到db_commit): txn_owner 线程一直持有write_lock
+  // 期间所有语句共用write_txn_id，提交前其他读者看不到
+  _Atomic bool in_transaction;
+  pthread_t txn_owner;
+  // 活跃读视图，决定旧版本何时可以回收; 视图关闭时广播views_closed
+  pthread_mutex_t readers_lock;
+  pthread_cond_t views_closed;
+  ReadView* read_views;
+  // 全表扫描、建索引和导入使用的线程数，db_set_threads(.threads) 设置
+  _Atomic uint32_t scan_threads;
+  // 最近结束的一次全表扫描访问的叶子数和被zone map 跳过的叶子数，.stats 查看
+  // 扫描在局部计数，结束时整体发布，其他线程同时扫描时取最后发布的
+  _Atomic uint32_t scan_leaves;
+  _Atomic uint32_t scan_skipped_leaves;
+  // 二级索引各自一个文件: <filename>.username.idx / <filename>.email.idx
+  // 未建索引时为NULL，索引的读写都在write_lock 下进行
+  char* filename;
+  Pager* indexes[2];
+  // 正在建的索引: 建索引期间写入的key 先记在这里，建完后补进索引
+  IndexCatchUp index_catchup[2];
+  // 索引或scan_threads 变化时加1，缓存的访问路径随之失效
+  _Atomic uint32_t plan_version;
+  // 快照上为NULL
+  PlanCache* plan_cache;
 } Table;
 
 typedef struct {
@@ -116,6 +345,8 @@ typedef struct {
   uint32_t page_num;
   uint32_t cell_num;
   bool end_of_table;
+  // 找到叶子时记录的页面版本，读完数据后用来校验
+  uint64_t version;
 } Cursor;
 
 // 通用节点Header Layout
@@ -134,17 +365,38 @@ const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET =
     LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                       LEAF_NODE_NUM_CELLS_SIZE +
-                                       LEAF_NODE_NEXT_LEAF_SIZE;
+// zone map: 叶子内所有版本username 前8字节的最小/最大值，email 域名的bloom
+// 只会变宽不会漏掉，过滤扫描据此整叶跳过
+const uint32_t LEAF_NODE_ZONE_PREFIX_SIZE = 8;
+const uint32_t LEAF_NODE_ZONE_MIN_OFFSET =
+    LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_ZONE_MAX_OFFSET =
+    LEAF_NODE_ZONE_MIN_OFFSET + LEAF_NODE_ZONE_PREFIX_SIZE;
+const uint32_t LEAF_NODE_ZONE_BLOOM_SIZE = sizeof(uint64_t);
+const uint32_t LEAF_NODE_ZONE_BLOOM_OFFSET =
+    LEAF_NODE_ZONE_MAX_OFFSET + LEAF_NODE_ZONE_PREFIX_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE =
+    COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE +
+    LEAF_NODE_NEXT_LEAF_SIZE + 2 * LEAF_NODE_ZONE_PREFIX_SIZE +
+    LEAF_NODE_ZONE_BLOOM_SIZE;
 
-// 叶子节点Body Layout
+// 叶子节点Body Layout |key(4)|xmin(4)|xmax(4)|row(293)|
+// 同一个key 可以有多个版本，按从新到旧相邻排列
 const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_KEY_OFFSET = 0;
+// 创建该版本的事务号
+const uint32_t LEAF_NODE_XMIN_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_XMIN_OFFSET =
+    LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
+// 删除(或被新版本替代)该版本的事务号
+const uint32_t LEAF_NODE_XMAX_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_XMAX_OFFSET =
+    LEAF_NODE_XMIN_OFFSET + LEAF_NODE_XMIN_SIZE;
 const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
 const uint32_t LEAF_NODE_VALUE_OFFSET =
-    LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
-const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
+    LEAF_NODE_XMAX_OFFSET + LEAF_NODE_XMAX_SIZE;
+const uint32_t LEAF_NODE_CELL_SIZE =
+    LEAF_NODE_VALUE_OFFSET + LEAF_NODE_VALUE_SIZE;
 const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_MAX_CELLS =
     LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
@@ -158,15 +410,43 @@ const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET =
     INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
-                                           INTERNAL_NODE_NUM_KEYS_SIZE +
-                                           INTERNAL_NODE_RIGHT_CHILD_SIZE;
+// 子树中未被删除(xmax 为空)的版本数，即已提交的行数
+const uint32_t INTERNAL_NODE_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_OFFSET =
+    INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE =
+    COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE +
+    INTERNAL_NODE_RIGHT_CHILD_SIZE + INTERNAL_NODE_COUNT_SIZE;
 
-// 内部节点Body Layout
+// 内部节点Body Layout |child(4)|key(4)|count(4)|
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CELL_SIZE =
+const uint32_t INTERNAL_NODE_COUNT_OFFSET =
     INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
+const uint32_t INTERNAL_NODE_CELL_SIZE =
+    INTERNAL_NODE_COUNT_OFFSET + INTERNAL_NODE_COUNT_SIZE;
+const uint32_t INTERNAL_NODE_MAX_CELLS =
+    (PAGE_SIZE - INTERNAL_NODE_HEADER_SIZE) / INTERNAL_NODE_CELL_SIZE;
+
+// 二级索引的key |value(32)|id(4)|: 列值前32字节(不足补0) + id，按此排序
+// email 超过32字节的部分不在索引里，查到后回表比较
+const uint32_t INDEX_VALUE_SIZE = 32;
+const uint32_t INDEX_KEY_SIZE = INDEX_VALUE_SIZE + sizeof(uint32_t);
+// 索引叶子header 与表的叶子相同(不带zone map)，body 只存key
+const uint32_t INDEX_LEAF_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                        LEAF_NODE_NUM_CELLS_SIZE +
+                                        LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t INDEX_LEAF_MAX_CELLS =
+    (PAGE_SIZE - INDEX_LEAF_HEADER_SIZE) / INDEX_KEY_SIZE;
+// 索引内部节点header 为num_keys/right_child，body |child(4)|key(36)|
+// key 为子树中最大的key，与表的内部节点一样内部节点不切分
+const uint32_t INDEX_INTERNAL_HEADER_SIZE = COMMON_NODE_HEADER_SIZE +
+                                            INTERNAL_NODE_NUM_KEYS_SIZE +
+                                            INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INDEX_INTERNAL_CELL_SIZE =
+    INTERNAL_NODE_CHILD_SIZE + INDEX_KEY_SIZE;
+const uint32_t INDEX_INTERNAL_MAX_CELLS =
+    (PAGE_SIZE - INDEX_INTERNAL_HEADER_SIZE) / INDEX_INTERNAL_CELL_SIZE;
 
 NodeType get_node_type(void* node) {
   uint8_t value = *(uint8_t*)(node + NODE_TYPE_OFFSET);
@@ -192,20 +472,159 @@ uint32_t* leaf_node_num_cells(void* node) {
 uint32_t* leaf_node_next_leaf(void* node) {
   return node + LEAF_NODE_NEXT_LEAF_OFFSET;
 }
+char* leaf_node_zone_min(void* node) { return node + LEAF_NODE_ZONE_MIN_OFFSET; }
+char* leaf_node_zone_max(void* node) { return node + LEAF_NODE_ZONE_MAX_OFFSET; }
+uint64_t* leaf_node_zone_bloom(void* node) {
+  return node + LEAF_NODE_ZONE_BLOOM_OFFSET;
+}
 void* leaf_node_cell(void* node, uint32_t cell_num) {
   return node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
 }
 uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
   return leaf_node_cell(node, cell_num);
 }
+uint32_t* leaf_node_xmin(void* node, uint32_t cell_num) {
+  return leaf_node_cell(node, cell_num) + LEAF_NODE_XMIN_OFFSET;
+}
+uint32_t* leaf_node_xmax(void* node, uint32_t cell_num) {
+  return leaf_node_cell(node, cell_num) + LEAF_NODE_XMAX_OFFSET;
+}
 void* leaf_node_value(void* node, uint32_t cell_num) {
-  return leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+  return leaf_node_cell(node, cell_num) + LEAF_NODE_VALUE_OFFSET;
+}
+// 版本对txn_id 可见: 创建者已提交，且删除者未提交或不存在
+bool leaf_node_visible(void* node, uint32_t cell_num, uint32_t txn_id) {
+  uint32_t xmin = *leaf_node_xmin(node, cell_num);
+  uint32_t xmax = *leaf_node_xmax(node, cell_num);
+  return xmin <= txn_id && (xmax == TXN_NONE || xmax > txn_id);
+}
+void leaf_node_zone_rebuild(void* node);
+// 清理已提交删除且不晚于horizon 的版本，没有读者还能看到它们
+// 至少保留一个cell，叶子不会变空(父节点还要用它的最大key)
+uint32_t leaf_node_prune(void* node, uint32_t horizon) {
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t kept = 0;
+  FORLESS(num_cells) {
+    uint32_t xmax = *leaf_node_xmax(node, i);
+    bool dead = xmax != TXN_NONE && xmax <= horizon;
+    if (dead && !(kept == 0 && i == num_cells - 1)) {
+      continue;
+    }
+    if (kept != i) {
+      memcpy(leaf_node_cell(node, kept), leaf_node_cell(node, i),
+             LEAF_NODE_CELL_SIZE);
+    }
+    kept++;
+  }
+  *leaf_node_num_cells(node) = kept;
+  if (kept != num_cells) {
+    leaf_node_zone_rebuild(node);
+  }
+  return num_cells - kept;
+}
+// 不晚于horizon 删除的版本数
+uint32_t leaf_node_count_dead(void* node, uint32_t horizon) {
+  uint32_t dead = 0;
+  FORLESS(*leaf_node_num_cells(node)) {
+    uint32_t xmax = *leaf_node_xmax(node, i);
+    dead += xmax != TXN_NONE && xmax <= horizon;
+  }
+  return dead;
+}
+// 关闭前冻结版本: 剩下的版本都已提交，下次打开事务号从头开始
+void leaf_node_freeze(void* node, uint32_t horizon) {
+  leaf_node_prune(node, horizon);
+  FORLESS(*leaf_node_num_cells(node)) {
+    *leaf_node_xmin(node, i) = TXN_FROZEN;
+    if (*leaf_node_xmax(node, i) != TXN_NONE) {
+      *leaf_node_xmax(node, i) = TXN_FROZEN;
+    }
+  }
+}
+// 第一个key 不小于目标key 的位置，新版本插在这里(排在旧版本前面)
+uint32_t leaf_node_lower_bound(void* node, uint32_t num_cells, uint32_t key) {
+  uint32_t min = 0;
+  uint32_t max = num_cells;
+  while (max != min) {
+    uint32_t index = (min + max) / 2;
+    if (*leaf_node_key(node, index) < key) {
+      min = index + 1;
+    } else {
+      max = index;
+    }
+  }
+  return min;
+}
+// email 域名(最后一个'@' 之后)在bloom 中的两个位，没有'@' 返回0
+uint64_t zone_domain_bits(const char* email, uint32_t len) {
+  const char* at = NULL;
+  FORLESS(len) {
+    if (email[i] == '@') {
+      at = email + i;
+    }
+  }
+  if (at == NULL) {
+    return 0;
+  }
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char* c = at + 1; c < email + len; c++) {
+    hash = (hash ^ (uint8_t)*c) * 1099511628211ULL;
+  }
+  return (1ULL << (hash & 63)) | (1ULL << ((hash >> 32) & 63));
+}
+// 定长前缀: source 的前size 字节，不足的补0，不一定以'\0' 结尾
+void prefix_copy(char* target, const char* source, uint32_t size) {
+  uint32_t length = strnlen(source, size);
+  memcpy(target, source, length);
+  memset(target + length, 0, size - length);
+}
+// 把一行并入叶子的zone map
+void leaf_node_zone_add(void* node, void* value) {
+  char prefix[LEAF_NODE_ZONE_PREFIX_SIZE];
+  prefix_copy(prefix, value + USERNAME_OFFSET, LEAF_NODE_ZONE_PREFIX_SIZE);
+  if (memcmp(prefix, leaf_node_zone_min(node), LEAF_NODE_ZONE_PREFIX_SIZE) <
+      0) {
+    memcpy(leaf_node_zone_min(node), prefix, LEAF_NODE_ZONE_PREFIX_SIZE);
+  }
+  if (memcmp(prefix, leaf_node_zone_max(node), LEAF_NODE_ZONE_PREFIX_SIZE) >
+      0) {
+    memcpy(leaf_node_zone_max(node), prefix, LEAF_NODE_ZONE_PREFIX_SIZE);
+  }
+  char* email = value + EMAIL_OFFSET;
+  *leaf_node_zone_bloom(node) |= zone_domain_bits(email, strnlen(email, EMAIL_SIZE));
+}
+// 空zone map: min > max，任何过滤都会跳过
+void leaf_node_zone_reset(void* node) {
+  memset(leaf_node_zone_min(node), 0xFF, LEAF_NODE_ZONE_PREFIX_SIZE);
+  memset(leaf_node_zone_max(node), 0, LEAF_NODE_ZONE_PREFIX_SIZE);
+  *leaf_node_zone_bloom(node) = 0;
+}
+// 切分、回收后按剩下的版本重新计算
+void leaf_node_zone_rebuild(void* node) {
+  leaf_node_zone_reset(node);
+  FORLESS(*leaf_node_num_cells(node)) {
+    leaf_node_zone_add(node, leaf_node_value(node, i));
+  }
+}
+// 叶子中是否可能有满足过滤条件的行，返回false 时整个叶子可以跳过
+bool leaf_node_zone_may_match(void* node, Statement* statement) {
+  if (statement->zone_by_username &&
+      (memcmp(statement->zone_hi, leaf_node_zone_min(node),
+              LEAF_NODE_ZONE_PREFIX_SIZE) < 0 ||
+       memcmp(statement->zone_lo, leaf_node_zone_max(node),
+              LEAF_NODE_ZONE_PREFIX_SIZE) > 0)) {
+    return false;
+  }
+  uint64_t bloom = statement->zone_bloom;
+  return (*leaf_node_zone_bloom(node) & bloom) == bloom;
 }
 void initialize_leaf_node(void* node) {
   set_node_type(node, NODE_LEAF);
   set_node_root(node, false);
   *leaf_node_num_cells(node) = 0;
   *leaf_node_next_leaf(node) = 0;
+  leaf_node_zone_reset(node);
 }
 
 uint32_t* internal_node_num_keys(void* node) {
@@ -241,10 +660,33 @@ uint32_t* internal_node_key(void* node, uint32_t key_num) {
   // 指针偏移不要搞错
   return (void*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
 }
+// 第child_num 个子树的行数，等于num_keys 时是right_child 的
+uint32_t* internal_node_count(void* node, uint32_t child_num) {
+  if (child_num == *internal_node_num_keys(node)) {
+    return node + INTERNAL_NODE_RIGHT_COUNT_OFFSET;
+  }
+  return (void*)internal_node_cell(node, child_num) +
+         INTERNAL_NODE_COUNT_OFFSET;
+}
 void initialize_internal_node(void* node) {
   set_node_type(node, NODE_INTERNAL);
   set_node_root(node, false);
   *internal_node_num_keys(node) = 0;
+  *internal_node_count(node, 0) = 0;
+}
+// 节点下的行数: 叶子数未删除的版本，内部节点累加子树计数
+uint32_t node_live_count(void* node) {
+  uint32_t count = 0;
+  if (get_node_type(node) == NODE_LEAF) {
+    FORLESS(*leaf_node_num_cells(node)) {
+      count += *leaf_node_xmax(node, i) == TXN_NONE;
+    }
+  } else {
+    FORLESS(*internal_node_num_keys(node) + 1) {
+      count += *internal_node_count(node, i);
+    }
+  }
+  return count;
 }
 
 uint32_t get_node_max_key(void* node) {
@@ -259,9 +701,54 @@ uint32_t get_unused_page_num(Pager* pager) { return pager->num_pages; }
 
 ///////////////
 void* get_page(Pager* pager, uint32_t page_num);
+bool pager_load(Pager* pager, uint32_t page_num, bool nowait);
+void* get_page_for_write(Pager* pager, uint32_t page_num);
 Cursor* table_find(Table* table, uint32_t key);
+Cursor* internal_node_find(Table* table, uint32_t page_num, uint64_t version,
+                           uint32_t key);
+Pager* pager_open(const char* filename);
+ExecuteResult execute_range_select(Statement* statement, Table* table,
+                                   uint32_t lo, uint32_t hi);
+void statement_values(Statement* statement, Row* rows);
+uint32_t statement_id_list(Statement* statement, uint32_t* keys);
 ///////////////
 
+// 乐观读: 等待写者离开后记录页面版本
+uint64_t node_read_begin(Pager* pager, uint32_t page_num) {
+  uint64_t version;
+  while ((version = atomic_load_explicit(&pager->page_versions[page_num],
+                                         memory_order_acquire)) &
+         1) {
+    sched_yield();
+  }
+  return version;
+}
+// 读完后校验版本未变，否则读到的内容不可信，需要重试
+bool node_read_validate(Pager* pager, uint32_t page_num, uint64_t version) {
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&pager->page_versions[page_num],
+                              memory_order_relaxed) == version;
+}
+// 写者加锁页面: 版本变为奇数(写者之间已由table->write_lock互斥)
+void node_write_lock(Pager* pager, uint32_t page_num) {
+  FORLESS(pager->write_set_size) {
+    if (pager->write_set[i] == page_num) {
+      return;
+    }
+  }
+  pager->write_set[pager->write_set_size++] = page_num;
+  // seq_cst: 与pager_pin 配合，加锁后再检查pin 计数
+  atomic_fetch_add(&pager->page_versions[page_num], 1);
+}
+// 语句结束，解锁所有修改过的页面: 版本再加1变回偶数
+void pager_release_writes(Pager* pager) {
+  FORLESS(pager->write_set_size) {
+    atomic_fetch_add_explicit(&pager->page_versions[pager->write_set[i]], 1,
+                              memory_order_release);
+  }
+  pager->write_set_size = 0;
+}
+
 void print_constants() {
   printf("ROW_SIZE: %d\n", ROW_SIZE);
   printf("COMMON_NODE_HEADER_SIZE: %d\n", COMMON_NODE_HEADER_SIZE);
@@ -315,30 +802,23 @@ Cursor* table_start(Table* table) {
 
   return cursor;
 }
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
+// version 为进入该叶子前记录的版本，保存在cursor中由调用者读完数据后校验
+Cursor* leaf_node_find(Table* table, uint32_t page_num, uint64_t version,
+                       uint32_t key) {
   void* node = get_page(table->pager, page_num);
   uint32_t num_cells = *leaf_node_num_cells(node);
+  // 并发修改中可能读到不完整的数据，越界直接重试
+  if (num_cells > LEAF_NODE_MAX_CELLS) {
+    return NULL;
+  }
 
   Cursor* cursor = malloc(sizeof(Cursor));
   cursor->table = table;
   cursor->page_num = page_num;
-
-  uint32_t min = 0;
-  uint32_t max = num_cells;
-  while (max != min) {
-    uint32_t index = (min + max) / 2;
-    uint32_t indexKey = *leaf_node_key(node, index);
-    if (key == indexKey) {
-      cursor->cell_num = index;
-      return cursor;
-    }
-    if (key < indexKey) {
-      max = index;
-    } else {
-      min = index + 1;
-    }
-  }
-  cursor->cell_num = min;
+  cursor->version = version;
+  cursor->end_of_table = false;
+  // 同一key 有多个版本，定位到最新的那个
+  cursor->cell_num = leaf_node_lower_bound(node, num_cells, key);
   return cursor;
 }
 // 内部节点根据key 获取其索引位置
@@ -358,28 +838,60 @@ uint32_t internal_node_find_child(void* node, uint32_t key) {
   }
   return min;
 }
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
+// 根据页面类型继续下降; 版本校验失败返回NULL，由table_find 从root重试
+Cursor* node_find(Table* table, uint32_t page_num, uint64_t version,
+                  uint32_t key) {
   void* node = get_page(table->pager, page_num);
-  uint32_t child_index = internal_node_find_child(node, key);
-  uint32_t child_page_num = *internal_node_child(node, child_index);
-  void* child = get_page(table->pager, child_page_num);
-  switch (get_node_type(child)) {
+  NodeType type = get_node_type(node);
+  if (!node_read_validate(table->pager, page_num, version)) {
+    return NULL;
+  }
+  switch (type) {
   case NODE_INTERNAL:
-    return internal_node_find(table, child_page_num, key);
+    return internal_node_find(table, page_num, version, key);
   case NODE_LEAF:
-    return leaf_node_find(table, child_page_num, key);
+    return leaf_node_find(table, page_num, version, key);
+  }
+  return NULL;
+}
+Cursor* internal_node_find(Table* table, uint32_t page_num, uint64_t version,
+                           uint32_t key) {
+  Pager* pager = table->pager;
+  void* node = get_page(pager, page_num);
+  uint32_t num_keys = *internal_node_num_keys(node);
+  if (num_keys > INTERNAL_NODE_MAX_CELLS) {
+    return NULL;
   }
+  uint32_t child_index = internal_node_find_child(node, key);
+  // num_keys 只读一次: 并发修改时internal_node_child 的检查可能误报退出
+  uint32_t child_page_num = child_index >= num_keys
+                                ? *internal_node_right_child(node)
+                                : *internal_node_cell(node, child_index);
+  if (child_page_num >= TABLE_MAX_PAGES) {
+    return NULL;
+  }
+  // lock coupling: 先记录子节点版本，再确认父节点在此期间未被修改
+  uint64_t child_version = node_read_begin(pager, child_page_num);
+  if (!node_read_validate(pager, page_num, version)) {
+    return NULL;
+  }
+  return node_find(table, child_page_num, child_version, key);
 }
 Cursor* table_find(Table* table, uint32_t key) {
-  uint32_t root_page_num = table->root_page_num;
-  void* root_node = get_page(table->pager, root_page_num);
-
-  if (get_node_type(root_node) == NODE_LEAF) {
-    return leaf_node_find(table, root_page_num, key);
-  } else {
-    return internal_node_find(table, root_page_num, key);
+  while (true) {
+    uint32_t root_page_num = table->root_page_num;
+    uint64_t version = node_read_begin(table->pager, root_page_num);
+    Cursor* cursor = node_find(table, root_page_num, version, key);
+    if (cursor) {
+      return cursor;
+    }
   }
 }
+// 读完cursor 所在叶子的数据后校验，失败说明期间有写者修改了该叶子
+bool cursor_validate(Cursor* cursor) {
+  return node_read_validate(cursor->table->pager, cursor->page_num,
+                            cursor->version);
+}
 void cursor_advance(Cursor* cursor) {
   uint32_t page_num = cursor->page_num;
   void* node = get_page(cursor->table->pager, page_num);
@@ -397,8 +909,17 @@ void cursor_advance(Cursor* cursor) {
 }
 
 void del_table(Table* table) {
+  pthread_mutex_destroy(&table->pager->load_lock);
+  pthread_mutex_destroy(&table->write_lock);
+  pthread_mutex_destroy(&table->readers_lock);
+  pthread_cond_destroy(&table->views_closed);
   free(table->pager);
   table->pager = NULL;
+  free(table->filename);
+  if (table->plan_cache) {
+    pthread_mutex_destroy(&table->plan_cache->lock);
+    free(table->plan_cache);
+  }
   free(table);
 }
 // 根据打开的文件，返回出Table上下文
@@ -407,46 +928,373 @@ MetaCommandResult do_meta_command(InputBuffer* intput_buffer, Table* table);
 void print_row(Row* row) {
   printf("(%d %s %s)\n", row->id, row->username, row->email);
 }
-// 读取用户输入
-void read_line(InputBuffer* input_buffer) {
+// 读取用户输入，输入结束时返回false
+bool read_line(InputBuffer* input_buffer) {
   ssize_t bytes_read =
       getline(&input_buffer->buffer, &input_buffer->buffer_length, stdin);
   if (bytes_read == -1) {
+    if (feof(stdin)) {
+      return false;
+    }
     printf("get user input error: %s.\n", strerror(errno));
     exit(EXIT_FAILURE);
   }
-  input_buffer->buffer[strlen(input_buffer->buffer) - 1] = '\0';
-  input_buffer->str_length = strlen(input_buffer->buffer);
+  // 最后一行可能没有换行符
+  if (bytes_read > 0 && input_buffer->buffer[bytes_read - 1] == '\n') {
+    bytes_read--;
+  }
+  input_buffer->buffer[bytes_read] = '\0';
+  input_buffer->str_length = bytes_read;
+  return true;
 }
 
+// 页面缓冲尾部存放pin 计数: 被读者pin 住的缓冲，写者复制后再修改
+_Atomic uint32_t* page_pins(void* page) { return page + PAGE_SIZE; }
+void* page_alloc() {
+  void* page = malloc(PAGE_SIZE + sizeof(_Atomic uint32_t));
+  atomic_init(page_pins(page), 0);
+  return page;
+}
 void* get_page(Pager* pager, uint32_t page_num) {
+  if (page_num >= TABLE_MAX_PAGES) {
+    printf("Tried to fetch page number out of bounds. %d >= %d\n", page_num,
+           TABLE_MAX_PAGES);
+    exit(EXIT_FAILURE);
+  }
+  void* page = atomic_load_explicit(&pager->pages[page_num],
+                                    memory_order_acquire);
+  if (page == NULL) {
+    pager_load(pager, page_num, false);
+    page = atomic_load_explicit(&pager->pages[page_num],
+                                memory_order_acquire);
+  }
+  return page;
+}
+// 从文件读入页面，已在内存中直接返回true
+// nowait 时页面还不在系统缓存里就返回false，不阻塞等待磁盘
+bool pager_load(Pager* pager, uint32_t page_num, bool nowait) {
+  bool loaded = true;
+  // 多个读者可能同时缺页，加锁后再确认一次
+  pthread_mutex_lock(&pager->load_lock);
   if (pager->pages[page_num] == NULL) {
-    void* page = malloc(PAGE_SIZE);
+    void* page = page_alloc();
     // 判别原始文件内容大于查询页码
     uint32_t file_page_full_num = pager->file_length / PAGE_SIZE;
     if (pager->file_length % PAGE_SIZE) {
       file_page_full_num += 1;
     }
     // 超过则将文件数据拷贝给page内存
-    if (file_page_full_num >= page_num) {
-      off_t offset =
-          lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-      if (offset == -1) {
-        printf("get page error seek: %s.\n", strerror(errno));
-        exit(EXIT_FAILURE);
-      }
-      ssize_t read_bytes = read(pager->file_descriptor, page, PAGE_SIZE);
+    off_t offset = (off_t)page_num * PAGE_SIZE;
+    if (file_page_full_num > page_num && nowait) {
+#ifdef RWF_NOWAIT
+      struct iovec iov = {page, PAGE_SIZE};
+      loaded = preadv2(pager->file_descriptor, &iov, 1, offset, RWF_NOWAIT) ==
+               PAGE_SIZE;
+#else
+      loaded = false;
+#endif
+    } else if (file_page_full_num >= page_num) {
+      ssize_t read_bytes =
+          pread(pager->file_descriptor, page, PAGE_SIZE, offset);
       if (read_bytes == -1) {
         printf("get page error read: %s.\n", strerror(errno));
         exit(EXIT_FAILURE);
       }
     }
-    pager->pages[page_num] = page;
-    if (page_num >= pager->num_pages) {
-      pager->num_pages = page_num + 1;
+    if (loaded) {
+      if (page_num < file_page_full_num) {
+        pager->pages_read++;
+      }
+      atomic_store_explicit(&pager->pages[page_num], page,
+                            memory_order_release);
+      pager->page_epochs[page_num] = pager->epoch;
+      if (page_num >= pager->num_pages) {
+        pager->num_pages = page_num + 1;
+      }
+    } else {
+      free(page);
+    }
+  }
+  pthread_mutex_unlock(&pager->load_lock);
+  return loaded;
+}
+// 提交预读: 内核在后台把页面读进系统缓存，之后的pager_load 不再等待磁盘
+void pager_prefetch_async(Pager* pager, uint32_t page_num) {
+#ifdef POSIX_FADV_WILLNEED
+  posix_fadvise(pager->file_descriptor, (off_t)page_num * PAGE_SIZE, PAGE_SIZE,
+                POSIX_FADV_WILLNEED);
+#endif
+}
+// 写者获取页面: 先加写锁(版本变奇数)，乐观读者会等待或重试
+// 如果该页面缓冲可能被快照引用或被读者pin 住，复制一份再修改，旧缓冲留给它们
+// 先加锁再检查pin，与pager_pin 的先pin 再校验版本配合，不会漏掉读者
+void* get_page_for_write(Pager* pager, uint32_t page_num) {
+  void* page = get_page(pager, page_num);
+  node_write_lock(pager, page_num);
+  if (pager->page_epochs[page_num] <= pager->cow_epoch ||
+      atomic_load(page_pins(page)) > 0) {
+    void* copy = page_alloc();
+    memcpy(copy, page, PAGE_SIZE);
+    RetiredPage* retired = malloc(sizeof(RetiredPage));
+    retired->page = page;
+    retired->retired_epoch = pager->epoch;
+    retired->retired_phase = atomic_load(&pager->read_phase);
+    retired->next = pager->retired_pages;
+    pager->retired_pages = retired;
+    atomic_store_explicit(&pager->pages[page_num], copy,
+                          memory_order_release);
+    pager->page_epochs[page_num] = pager->epoch;
+    page = copy;
+  }
+  return page;
+}
+// 读者pin 住页面当前的缓冲，之后写者不会原地修改它
+// version 为之前node_read_begin 记录的版本，校验失败返回NULL 需要重试
+void* pager_pin(Pager* pager, uint32_t page_num, uint64_t version) {
+  void* page = get_page(pager, page_num);
+  atomic_fetch_add(page_pins(page), 1);
+  if (atomic_load(&pager->page_versions[page_num]) != version) {
+    atomic_fetch_sub(page_pins(page), 1);
+    return NULL;
+  }
+  return page;
+}
+// 被替换下来的缓冲在下次回收时释放
+void pager_unpin(void* page) { atomic_fetch_sub(page_pins(page), 1); }
+// 回收不再被快照引用、也没有被pin 的旧缓冲(持有write_lock 时调用)
+void pager_reclaim(Pager* pager) {
+  // 上一阶段的读者都离开了才推进阶段，空闲时一次推进两个阶段
+  FORLESS(2) {
+    uint32_t phase = atomic_load(&pager->read_phase);
+    if (atomic_load(&pager->phase_readers[(phase - 1) & 1]) != 0) {
+      break;
+    }
+    atomic_store(&pager->read_phase, phase + 1);
+  }
+  uint32_t phase = atomic_load(&pager->read_phase);
+  RetiredPage** link = &pager->retired_pages;
+  while (*link) {
+    RetiredPage* retired = *link;
+    // oldest_epoch 为0 表示没有快照了
+    if ((pager->oldest_epoch == 0 ||
+         pager->oldest_epoch >= retired->retired_epoch) &&
+        retired->retired_phase + 2 <= phase &&
+        atomic_load(page_pins(retired->page)) == 0) {
+      *link = retired->next;
+      free(retired->page);
+      free(retired);
+    } else {
+      link = &retired->next;
+    }
+  }
+}
+// 乐观读者进入: 登记在当前阶段，登记期间阶段被推进则重试
+uint32_t pager_read_enter(Pager* pager) {
+  while (true) {
+    uint32_t phase = atomic_load(&pager->read_phase);
+    atomic_fetch_add(&pager->phase_readers[phase & 1], 1);
+    if (atomic_load(&pager->read_phase) == phase) {
+      return phase;
+    }
+    atomic_fetch_sub(&pager->phase_readers[phase & 1], 1);
+  }
+}
+void pager_read_exit(Pager* pager, uint32_t phase) {
+  atomic_fetch_sub(&pager->phase_readers[phase & 1], 1);
+}
+// 当前线程是否在显式事务中，是则已经持有write_lock
+bool table_owns_transaction(Table* table) {
+  return atomic_load(&table->in_transaction) &&
+         pthread_equal(table->txn_owner, pthread_self());
+}
+// 显式事务中的语句不再加锁
+void table_write_lock(Table* table) {
+  if (!table_owns_transaction(table)) {
+    pthread_mutex_lock(&table->write_lock);
+  }
+}
+void table_write_unlock(Table* table) {
+  if (!table_owns_transaction(table)) {
+    pthread_mutex_unlock(&table->write_lock);
+  }
+}
+// 读者能看到的最新事务号: 事务中的线程还能看到自己未提交的修改
+uint32_t table_read_txn(Table* table) {
+  if (table_owns_transaction(table)) {
+    return table->write_txn_id;
+  }
+  return atomic_load(&table->committed_txn_id);
+}
+// 获取快照: 在写锁下拷贝当前页表，之后写者修改这些页面都会先复制
+// 快照读者不加任何锁，也不会阻塞写者
+Table* table_snapshot(Table* table) {
+  Pager* pager = table->pager;
+  table_write_lock(table);
+  // 先把所有页面读进来，快照只引用内存中的页面缓冲
+  FORLESS(pager->num_pages) { get_page(pager, i); }
+
+  Pager* snapshot_pager = malloc(sizeof(Pager));
+  FORLESS(TABLE_MAX_PAGES) {
+    atomic_init(&snapshot_pager->pages[i], atomic_load(&pager->pages[i]));
+  }
+  snapshot_pager->file_descriptor = pager->file_descriptor;
+  snapshot_pager->file_length = pager->file_length;
+  snapshot_pager->num_pages = pager->num_pages;
+  snapshot_pager->write_set_size = 0;
+  snapshot_pager->pages_read = 0;
+  pthread_mutex_init(&snapshot_pager->load_lock, NULL);
+  atomic_init(&snapshot_pager->read_phase, 1);
+  atomic_init(&snapshot_pager->phase_readers[0], 0);
+  atomic_init(&snapshot_pager->phase_readers[1], 0);
+  FORLESS(TABLE_MAX_PAGES) {
+    atomic_init(&snapshot_pager->page_versions[i], 0);
+  }
+  snapshot_pager->epoch = pager->epoch;
+  snapshot_pager->cow_epoch = 0;
+  snapshot_pager->oldest_epoch = 0;
+  snapshot_pager->retired_pages = NULL;
+
+  Table* snapshot = malloc(sizeof(Table));
+  snapshot->pager = snapshot_pager;
+  snapshot->root_page_num = table->root_page_num;
+  pthread_mutex_init(&snapshot->write_lock, NULL);
+  snapshot->parent = table;
+  snapshot->snapshot_epoch = pager->epoch;
+  snapshot->snapshots = NULL;
+  snapshot->next_snapshot = table->snapshots;
+  table->snapshots = snapshot;
+  // 快照只读，读到的版本就是获取快照时已提交的
+  snapshot->next_txn_id = table->next_txn_id;
+  atomic_init(&snapshot->committed_txn_id, table_read_txn(table));
+  snapshot->write_txn_id = TXN_NONE;
+  atomic_init(&snapshot->in_transaction, false);
+  pthread_mutex_init(&snapshot->readers_lock, NULL);
+  pthread_cond_init(&snapshot->views_closed, NULL);
+  snapshot->read_views = NULL;
+  atomic_init(&snapshot->scan_threads, 1);
+  atomic_init(&snapshot->scan_leaves, 0);
+  atomic_init(&snapshot->scan_skipped_leaves, 0);
+  snapshot->filename = NULL;
+  snapshot->indexes[0] = NULL;
+  snapshot->indexes[1] = NULL;
+  memset(snapshot->index_catchup, 0, sizeof(snapshot->index_catchup));
+  atomic_init(&snapshot->plan_version, 1);
+  snapshot->plan_cache = NULL;
+
+  pager->cow_epoch = pager->epoch;
+  if (pager->oldest_epoch == 0) {
+    pager->oldest_epoch = pager->epoch;
+  }
+  pager->epoch += 1;
+  table_write_unlock(table);
+  return snapshot;
+}
+void table_release_snapshot(Table* snapshot) {
+  Table* table = snapshot->parent;
+  Pager* pager = table->pager;
+  table_write_lock(table);
+  Table** link = &table->snapshots;
+  while (*link != snapshot) {
+    link = &(*link)->next_snapshot;
+  }
+  *link = snapshot->next_snapshot;
+  // 重新计算最新、最老的快照纪元
+  uint64_t newest = 0, oldest = 0;
+  for (Table* s = table->snapshots; s; s = s->next_snapshot) {
+    if (s->snapshot_epoch > newest) {
+      newest = s->snapshot_epoch;
+    }
+    if (oldest == 0 || s->snapshot_epoch < oldest) {
+      oldest = s->snapshot_epoch;
+    }
+  }
+  pager->cow_epoch = newest;
+  pager->oldest_epoch = oldest;
+  pager_reclaim(pager);
+  table_write_unlock(table);
+
+  pthread_mutex_destroy(&snapshot->pager->load_lock);
+  pthread_mutex_destroy(&snapshot->write_lock);
+  pthread_mutex_destroy(&snapshot->readers_lock);
+  pthread_cond_destroy(&snapshot->views_closed);
+  free(snapshot->pager);
+  free(snapshot);
+}
+
+// 写事务开始: 写者互斥，分配事务号
+// 显式事务中的语句沿用事务的锁和事务号
+void txn_begin(Table* table) {
+  if (table_owns_transaction(table)) {
+    return;
+  }
+  pthread_mutex_lock(&table->write_lock);
+  table->write_txn_id = table->next_txn_id++;
+}
+// 提交: 先解锁修改过的页面，再发布事务号，之后的读者才能看到本事务的版本
+// 显式事务中每条语句结束只解锁页面，事务号到db_commit 才发布
+void txn_commit(Table* table) {
+  pager_release_writes(table->pager);
+  pager_reclaim(table->pager);
+  if (table_owns_transaction(table)) {
+    return;
+  }
+  atomic_store(&table->committed_txn_id, table->write_txn_id);
+  pthread_mutex_unlock(&table->write_lock);
+}
+// 登记读视图: 看到此刻已提交的所有版本，关闭前这些版本不会被回收
+void read_view_open(Table* table, ReadView* view) {
+  pthread_mutex_lock(&table->readers_lock);
+  view->txn_id = table_read_txn(table);
+  view->next = table->read_views;
+  table->read_views = view;
+  pthread_mutex_unlock(&table->readers_lock);
+}
+void read_view_close(Table* table, ReadView* view) {
+  pthread_mutex_lock(&table->readers_lock);
+  ReadView** link = &table->read_views;
+  while (*link != view) {
+    link = &(*link)->next;
+  }
+  *link = view->next;
+  pthread_cond_broadcast(&table->views_closed);
+  pthread_mutex_unlock(&table->readers_lock);
+}
+// 持有readers_lock 时计算回收水位
+uint32_t table_gc_horizon_locked(Table* table) {
+  uint32_t horizon = atomic_load(&table->committed_txn_id);
+  for (ReadView* view = table->read_views; view; view = view->next) {
+    if (view->txn_id < horizon) {
+      horizon = view->txn_id;
     }
   }
-  return pager->pages[page_num];
+  return horizon;
+}
+// 回收水位: 不晚于它删除的版本对所有读者都不可见了
+// 快照读的是写时复制留下的旧页面，不受回收影响
+uint32_t table_gc_horizon(Table* table) {
+  pthread_mutex_lock(&table->readers_lock);
+  uint32_t horizon = table_gc_horizon_locked(table);
+  pthread_mutex_unlock(&table->readers_lock);
+  return horizon;
+}
+// 等早于txn_id 的读视图都关闭，最多等GC_WAIT_MS 毫秒，返回之后的回收水位
+// 调用线程自己开着视图(比如扫描回调中写入)时只会等到超时
+uint32_t table_wait_gc_horizon(Table* table, uint32_t txn_id) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += GC_WAIT_MS * 1000000l;
+  if (deadline.tv_nsec >= 1000000000l) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000l;
+  }
+  pthread_mutex_lock(&table->readers_lock);
+  while (table_gc_horizon_locked(table) < txn_id &&
+         pthread_cond_timedwait(&table->views_closed, &table->readers_lock,
+                                &deadline) == 0) {
+  }
+  uint32_t horizon = table_gc_horizon_locked(table);
+  pthread_mutex_unlock(&table->readers_lock);
+  return horizon;
 }
 
 void deserialize_row(Row* target, void* source) {
@@ -467,6 +1315,7 @@ void* cursor_value(Cursor* cursor) {
   return leaf_node_value(page, cursor->cell_num);
 }
 // 替换内部节点的key
+// node 需由get_page_for_write 获得
 void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
   // 先根据old_key找到对应索引
   uint32_t old_child_index = internal_node_find_child(node, old_key);
@@ -479,7 +1328,7 @@ void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
 // 否则，在internal中添加new_child 的内存页面坐标描述(page_num 和 key)
 void internal_node_insert(Table* table, uint32_t parent_page_num,
                           uint32_t child_page_num) {
-  void* parent = get_page(table->pager, parent_page_num);
+  void* parent = get_page_for_write(table->pager, parent_page_num);
   void* child = get_page(table->pager, child_page_num);
   uint32_t child_max_key = get_node_max_key(child);
   uint32_t index = internal_node_find_child(parent, child_max_key);
@@ -490,27 +1339,32 @@ void internal_node_insert(Table* table, uint32_t parent_page_num,
   uint32_t right_child_page_num = *internal_node_right_child(parent);
   void* right_child = get_page(table->pager, right_child_page_num);
 
+  uint32_t right_count = *internal_node_count(parent, original_num_keys + 1);
   if (child_max_key > get_node_max_key(right_child)) {
     *internal_node_child(parent, original_num_keys) = right_child_page_num;
     *internal_node_key(parent, original_num_keys) =
         get_node_max_key(right_child);
+    *internal_node_count(parent, original_num_keys) = right_count;
     *internal_node_right_child(parent) = child_page_num;
+    *internal_node_count(parent, original_num_keys + 1) =
+        node_live_count(child);
   } else {
     for (uint32_t i = original_num_keys; i > index; i--) {
       void* destination = internal_node_cell(parent, i);
-      void* source = internal_node_cell(parent, i);
+      void* source = internal_node_cell(parent, i - 1);
       memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
     }
     *internal_node_child(parent, index) = child_page_num;
     *internal_node_key(parent, index) = child_max_key;
+    *internal_node_count(parent, index) = node_live_count(child);
   }
 }
 void create_new_root(Table* table, uint32_t right_child_page_num) {
-  void* root = get_page(table->pager, table->root_page_num);
-  void* right_child = get_page(table->pager, right_child_page_num);
+  void* root = get_page_for_write(table->pager, table->root_page_num);
+  void* right_child = get_page_for_write(table->pager, right_child_page_num);
   // 生成left child
   uint32_t left_child_page_num = get_unused_page_num(table->pager);
-  void* left_child = get_page(table->pager, left_child_page_num);
+  void* left_child = get_page_for_write(table->pager, left_child_page_num);
   // left_child 内容其实就是root内容(root 内容之后变更)
   memcpy(left_child, root, PAGE_SIZE);
   set_node_root(left_child, false);
@@ -523,14 +1377,43 @@ void create_new_root(Table* table, uint32_t right_child_page_num) {
   *internal_node_key(root, 0) = left_child_max_key;
   *internal_node_right_child(root) = right_child_page_num;
 
+  *internal_node_count(root, 0) = node_live_count(left_child);
+  *internal_node_count(root, 1) = node_live_count(right_child);
+
   *node_parent(left_child) = table->root_page_num;
   *node_parent(right_child) = table->root_page_num;
 }
+// 节点的行数变化后，沿父指针更新到root 上的子树计数
+void node_refresh_count(Table* table, uint32_t page_num) {
+  void* node = get_page(table->pager, page_num);
+  while (!is_node_root(node)) {
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page_for_write(table->pager, parent_page_num);
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+      if (*internal_node_child(parent, i) == page_num) {
+        *internal_node_count(parent, i) = node_live_count(node);
+        break;
+      }
+    }
+    page_num = parent_page_num;
+    node = parent;
+  }
+}
+// 写入一个新版本，创建者为当前写事务
+void leaf_node_write_version(Table* table, void* node, uint32_t cell_num,
+                             uint32_t key, Row* value) {
+  *leaf_node_key(node, cell_num) = key;
+  *leaf_node_xmin(node, cell_num) = table->write_txn_id;
+  *leaf_node_xmax(node, cell_num) = TXN_NONE;
+  serialize_row(leaf_node_value(node, cell_num), value);
+  leaf_node_zone_add(node, leaf_node_value(node, cell_num));
+}
 void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
-  void* old_node = get_page(cursor->table->pager, cursor->page_num);
+  void* old_node = get_page_for_write(cursor->table->pager, cursor->page_num);
   uint32_t old_node_old_max = get_node_max_key(old_node);
   uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-  void* new_node = get_page(cursor->table->pager, new_page_num);
+  void* new_node = get_page_for_write(cursor->table->pager, new_page_num);
   initialize_leaf_node(new_node);
   *node_parent(new_node) = *node_parent(old_node);
   *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
@@ -547,9 +1430,8 @@ void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
     void* destination = leaf_node_cell(destination_node, index_within_node);
 
     if (i == cursor->cell_num) {
-      serialize_row(leaf_node_value(destination_node, index_within_node),
-                    value);
-      *leaf_node_key(destination_node, index_within_node) = key;
+      leaf_node_write_version(cursor->table, destination_node,
+                              index_within_node, key, value);
     } else if (i > cursor->cell_num) {
       memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
     } else {
@@ -558,6 +1440,8 @@ void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
   }
   *leaf_node_num_cells(old_node) = LEAF_NODE_LEFT_SPLIT_COUNT;
   *leaf_node_num_cells(new_node) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+  leaf_node_zone_rebuild(old_node);
+  leaf_node_zone_rebuild(new_node);
   if (is_node_root(old_node)) {
     return create_new_root(cursor->table, new_page_num);
   } else {
@@ -565,15 +1449,62 @@ void leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
     // 且得知old_node 不是root节点，所以目标就是更新原来的internal节点中元素
     uint32_t parent_page_num = *node_parent(old_node);
     uint32_t old_node_new_max = get_node_max_key(old_node);
-    void* parent = get_page(cursor->table->pager, parent_page_num);
+    void* parent = get_page_for_write(cursor->table->pager, parent_page_num);
     // 更新父节点old_node 原来对应的信息: old_node_old_max-->old_node_new_max
     update_internal_node_key(parent, old_node_old_max, old_node_new_max);
     // 剩余工作是决定new_page_num位置(right_child ? 还是 left_childs)
     internal_node_insert(cursor->table, parent_page_num, new_page_num);
+    node_refresh_count(cursor->table, cursor->page_num);
+  }
+}
+// 叶子page_num 再切出new_leaves 个叶子所需的页面是否还有
+// 叶子是root 时原来的内容还要一页; 内部节点不分裂，父节点也要放得下
+bool leaf_node_can_split(Table* table, uint32_t page_num, uint32_t new_leaves) {
+  Pager* pager = table->pager;
+  void* node = get_page(pager, page_num);
+  uint32_t needed = new_leaves + (is_node_root(node) ? 1 : 0);
+  if (pager->num_pages + needed > TABLE_MAX_PAGES) {
+    return false;
+  }
+  if (is_node_root(node)) {
+    return true;
+  }
+  void* parent = get_page(pager, *node_parent(node));
+  return *internal_node_num_keys(parent) + new_leaves <=
+         INTERNAL_NODE_MAX_CELLS;
+}
+// 插入一个版本前在cursor 的叶子上腾出位置: 满了先回收旧版本，
+// 回收后仍然满就要切分，表已经没有页面时返回EXECUTE_FULL_TABLE，树不做任何修改
+ExecuteResult leaf_node_make_room(Cursor* cursor, uint32_t key) {
+  Table* table = cursor->table;
+  void* node = get_page(table->pager, cursor->page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  if (num_cells < LEAF_NODE_MAX_CELLS) {
+    return EXECUTE_SUCCESS;
   }
+  // 已提交删除的旧版本只被开着的读视图挡住时，等视图关闭后回收，而不是切分
+  // 否则扫描不断的表上叶子只会越切越多; 在取得写页面之前等，不挡住扫描
+  uint32_t horizon = table_gc_horizon(table);
+  uint32_t committed = atomic_load(&table->committed_txn_id);
+  if (leaf_node_count_dead(node, committed) >
+      leaf_node_count_dead(node, horizon)) {
+    horizon = table_wait_gc_horizon(table, committed);
+  }
+  node = get_page_for_write(table->pager, cursor->page_num);
+  if (leaf_node_prune(node, horizon) > 0) {
+    num_cells = *leaf_node_num_cells(node);
+    cursor->cell_num = leaf_node_lower_bound(node, num_cells, key);
+  }
+  if (num_cells >= LEAF_NODE_MAX_CELLS &&
+      !leaf_node_can_split(table, cursor->page_num, 1)) {
+    return EXECUTE_FULL_TABLE;
+  }
+  return EXECUTE_SUCCESS;
 }
+// 调用前先leaf_node_make_room
 void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
-  void* node = get_page(cursor->table->pager, cursor->page_num);
+  Table* table = cursor->table;
+  void* node = get_page_for_write(table->pager, cursor->page_num);
 
   uint32_t num_cells = *leaf_node_num_cells(node);
   if (num_cells >= LEAF_NODE_MAX_CELLS) {
@@ -588,100 +1519,2808 @@ void leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
     }
   }
   *(leaf_node_num_cells(node)) += 1;
-  *(leaf_node_key(node, cursor->cell_num)) = key;
-  serialize_row(leaf_node_value(node, cursor->cell_num), value);
+  leaf_node_write_version(table, node, cursor->cell_num, key, value);
+  node_refresh_count(table, cursor->page_num);
 }
-ExecuteResult execute_insert(Statement* statement, Table* table) {
-  void* node = get_page(table->pager, table->root_page_num);
-  uint32_t num_cells = *leaf_node_num_cells(node);
-
-  Row* row_to_insert = &statement->row_to_insert;
-  uint32_t key_to_insert = row_to_insert->id;
-  Cursor* cursor = table_find(table, key_to_insert);
-  // 如果指定生成的元素位置在中间，需要判别是否报错插入了相同的元素
-  if (cursor->cell_num < num_cells) {
-    uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
-    if (key_at_index == key_to_insert) {
-      return EXECUTE_DUPLICATE_KEY;
+// 写者: 找到key 未被删除的最新版本
+// 最新版本在cursor 处，cursor 在叶子末尾时则在下一个叶子开头
+bool cursor_find_live(Cursor* cursor, uint32_t key, uint32_t* page_num,
+                      uint32_t* cell_num) {
+  Pager* pager = cursor->table->pager;
+  void* node = get_page(pager, cursor->page_num);
+  *page_num = cursor->page_num;
+  *cell_num = cursor->cell_num;
+  if (*cell_num >= *leaf_node_num_cells(node)) {
+    *page_num = *leaf_node_next_leaf(node);
+    *cell_num = 0;
+    if (*page_num == 0) {
+      return false;
     }
+    node = get_page(pager, *page_num);
   }
-
-  leaf_node_insert(cursor, row_to_insert->id, row_to_insert);
-
-  free(cursor);
-  return EXECUTE_SUCCESS;
+  return *cell_num < *leaf_node_num_cells(node) &&
+         *leaf_node_key(node, *cell_num) == key &&
+         *leaf_node_xmax(node, *cell_num) == TXN_NONE;
 }
-ExecuteResult execute_select(Statement* statement, Table* table) {
-  Row row;
-  Cursor* cursor = table_start(table);
-  // 简单处理，select时打印全部
-  while (!cursor->end_of_table) {
-    // 找到i在哪个page的offset 偏移内存点
-    void* page = cursor_value(cursor);
-    deserialize_row(&row, page);
-    print_row(&row);
-    cursor_advance(cursor);
-  }
-  free(cursor);
-
-  return EXECUTE_SUCCESS;
+// 二级索引在Table->indexes 中的位置
+uint32_t index_slot(Projection column) {
+  return column == PROJECTION_USERNAME ? 0 : 1;
 }
-ExecuteResult execute_statement(Statement* statement, Table* table) {
-  switch (statement->type) {
-  case STATEMENT_INSERT:
-    return execute_insert(statement, table);
-  case STATEMENT_SELECT:
-    return execute_select(statement, table);
-  }
+char* index_column_name(Projection column) {
+  return column == PROJECTION_USERNAME ? "username" : "email";
 }
-// InputBuffer -> Statement
-PrepareResult prepare_insert(InputBuffer* input_buffer, Statement* statement) {
-  static char* token = " ";
-  strtok(input_buffer->buffer, token);
-  char* idStr = strtok(NULL, token);
-  char* username = strtok(NULL, token);
-  char* email = strtok(NULL, token);
-  if (!idStr || !username || !email) {
-    return PREPARE_SYNTAX_ERROR;
-  }
-  uint32_t id = atoi(idStr);
-  if (id < 0) {
-    return PREPARE_NEGATIVE_ID;
-  }
-  if (strlen(username) > COLUMN_USERNAME) {
-    return PREPARE_STRING_TOO_LONG;
-  }
-  if (strlen(email) > COLUMN_EMAIL) {
-    return PREPARE_STRING_TOO_LONG;
-  }
-  statement->type = STATEMENT_INSERT;
-  statement->row_to_insert.id = id;
-  strcpy(statement->row_to_insert.username, username);
-  strcpy(statement->row_to_insert.email, email);
-  return PREPARE_SUCCESS;
+void index_key_make(char* key, const char* value, uint32_t id) {
+  prefix_copy(key, value, INDEX_VALUE_SIZE);
+  memcpy(key + INDEX_VALUE_SIZE, &id, sizeof(uint32_t));
 }
-// InputBuffer -> Statement 入口
-PrepareResult prepare_statement(InputBuffer* input_buffer,
-                                Statement* statement) {
-  if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-    return prepare_insert(input_buffer, statement);
-  }
-  if (strcmp(input_buffer->buffer, "select") == 0) {
-    statement->type = STATEMENT_SELECT;
-    return PREPARE_SUCCESS;
+// 先比较列值前缀，再比较id
+int index_key_compare(const char* a, const char* b) {
+  int result = memcmp(a, b, INDEX_VALUE_SIZE);
+  if (result != 0) {
+    return result;
   }
-  return PREPARE_UNRECOGNIZED_STATEMENT;
+  uint32_t a_id = *(uint32_t*)(a + INDEX_VALUE_SIZE);
+  uint32_t b_id = *(uint32_t*)(b + INDEX_VALUE_SIZE);
+  return a_id < b_id ? -1 : a_id > b_id;
 }
-int main(int argc, char** argv) {
-  char* filename;
-  if (argc > 1) {
-    filename = argv[1];
+char* index_leaf_key(void* node, uint32_t cell_num) {
+  return node + INDEX_LEAF_HEADER_SIZE + cell_num * INDEX_KEY_SIZE;
+}
+void* index_internal_cell(void* node, uint32_t cell_num) {
+  return node + INDEX_INTERNAL_HEADER_SIZE +
+         cell_num * INDEX_INTERNAL_CELL_SIZE;
+}
+uint32_t* index_internal_child(void* node, uint32_t child_num) {
+  if (child_num == *internal_node_num_keys(node)) {
+    return internal_node_right_child(node);
   }
-  Table* table = db_open(filename);
-  while (true) {
+  return index_internal_cell(node, child_num);
+}
+char* index_internal_key(void* node, uint32_t key_num) {
+  return index_internal_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE;
+}
+void index_initialize_leaf(void* node) {
+  set_node_type(node, NODE_LEAF);
+  set_node_root(node, false);
+  *leaf_node_num_cells(node) = 0;
+  *leaf_node_next_leaf(node) = 0;
+}
+char* index_node_max_key(void* node) {
+  if (get_node_type(node) == NODE_LEAF) {
+    return index_leaf_key(node, *leaf_node_num_cells(node) - 1);
+  }
+  uint32_t num_keys = *internal_node_num_keys(node);
+  return index_internal_key(node, num_keys - 1);
+}
+// 第一个不小于key 的位置
+uint32_t index_leaf_lower_bound(void* node, const char* key) {
+  uint32_t min = 0;
+  uint32_t max = *leaf_node_num_cells(node);
+  while (min != max) {
+    uint32_t index = (min + max) / 2;
+    if (index_key_compare(index_leaf_key(node, index), key) < 0) {
+      min = index + 1;
+    } else {
+      max = index;
+    }
+  }
+  return min;
+}
+// 从root 下降到key 所在的叶子
+uint32_t index_find_leaf(Pager* pager, const char* key) {
+  uint32_t page_num = 0;
+  void* node = get_page(pager, page_num);
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t min = 0;
+    uint32_t max = *internal_node_num_keys(node);
+    while (min != max) {
+      uint32_t index = (min + max) / 2;
+      if (index_key_compare(index_internal_key(node, index), key) >= 0) {
+        max = index;
+      } else {
+        min = index + 1;
+      }
+    }
+    page_num = *index_internal_child(node, min);
+    node = get_page(pager, page_num);
+  }
+  return page_num;
+}
+// 满的叶子加上新key 后对半分到新页面，父节点记录新页面和两边的最大key
+void index_leaf_split_and_insert(Pager* pager, uint32_t page_num,
+                                 uint32_t cell_num, const char* key) {
+  void* old_node = get_page(pager, page_num);
+  uint32_t num_cells = INDEX_LEAF_MAX_CELLS + 1;
+  char* cells = malloc(num_cells * INDEX_KEY_SIZE);
+  memcpy(cells, index_leaf_key(old_node, 0), cell_num * INDEX_KEY_SIZE);
+  memcpy(cells + cell_num * INDEX_KEY_SIZE, key, INDEX_KEY_SIZE);
+  memcpy(cells + (cell_num + 1) * INDEX_KEY_SIZE,
+         index_leaf_key(old_node, cell_num),
+         (INDEX_LEAF_MAX_CELLS - cell_num) * INDEX_KEY_SIZE);
+
+  uint32_t left_count = num_cells / 2;
+  uint32_t new_page_num = get_unused_page_num(pager);
+  void* new_node = get_page(pager, new_page_num);
+  index_initialize_leaf(new_node);
+  *node_parent(new_node) = *node_parent(old_node);
+  *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
+  *leaf_node_next_leaf(old_node) = new_page_num;
+  memcpy(index_leaf_key(old_node, 0), cells, left_count * INDEX_KEY_SIZE);
+  memcpy(index_leaf_key(new_node, 0), cells + left_count * INDEX_KEY_SIZE,
+         (num_cells - left_count) * INDEX_KEY_SIZE);
+  *leaf_node_num_cells(old_node) = left_count;
+  *leaf_node_num_cells(new_node) = num_cells - left_count;
+  free(cells);
+
+  if (is_node_root(old_node)) {
+    // root 内容移到新的左叶子，root 变成内部节点
+    uint32_t left_page_num = get_unused_page_num(pager);
+    void* left_node = get_page(pager, left_page_num);
+    memcpy(left_node, old_node, PAGE_SIZE);
+    set_node_root(left_node, false);
+    *node_parent(left_node) = page_num;
+    *node_parent(new_node) = page_num;
+    set_node_type(old_node, NODE_INTERNAL);
+    *internal_node_num_keys(old_node) = 1;
+    *index_internal_child(old_node, 0) = left_page_num;
+    memcpy(index_internal_key(old_node, 0), index_node_max_key(left_node),
+           INDEX_KEY_SIZE);
+    *internal_node_right_child(old_node) = new_page_num;
+    return;
+  }
+  void* parent = get_page(pager, *node_parent(old_node));
+  uint32_t num_keys = *internal_node_num_keys(parent);
+  if (num_keys >= INDEX_INTERNAL_MAX_CELLS) {
+    printf("Index internal node is full.\n");
+    exit(EXIT_FAILURE);
+  }
+  uint32_t child_num = 0;
+  while (*index_internal_child(parent, child_num) != page_num) {
+    child_num++;
+  }
+  if (child_num == num_keys) {
+    // 原来是right_child: 它变成最后一个cell，新页面成为right_child
+    *(uint32_t*)index_internal_cell(parent, num_keys) = page_num;
+    memcpy(index_internal_key(parent, num_keys), index_node_max_key(old_node),
+           INDEX_KEY_SIZE);
+    *internal_node_right_child(parent) = new_page_num;
+  } else {
+    // 新页面接管原来的最大key，插在原页面后面
+    memmove(index_internal_cell(parent, child_num + 1),
+            index_internal_cell(parent, child_num),
+            (num_keys - child_num) * INDEX_INTERNAL_CELL_SIZE);
+    memcpy(index_internal_key(parent, child_num),
+           index_node_max_key(old_node), INDEX_KEY_SIZE);
+    *(uint32_t*)index_internal_cell(parent, child_num + 1) = new_page_num;
+  }
+  *internal_node_num_keys(parent) = num_keys + 1;
+}
+// 插入(value, id)，已存在则忽略(update 没有改变该列)
+// 旧值的key 不删除: 索引只给出候选id，查询时回表校验当前可见的行
+void index_insert(Pager* pager, const char* value, uint32_t id) {
+  char key[INDEX_KEY_SIZE];
+  index_key_make(key, value, id);
+  uint32_t page_num = index_find_leaf(pager, key);
+  void* node = get_page(pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  uint32_t cell_num = index_leaf_lower_bound(node, key);
+  if (cell_num < num_cells &&
+      index_key_compare(index_leaf_key(node, cell_num), key) == 0) {
+    return;
+  }
+  if (num_cells >= INDEX_LEAF_MAX_CELLS) {
+    index_leaf_split_and_insert(pager, page_num, cell_num, key);
+    return;
+  }
+  memmove(index_leaf_key(node, cell_num + 1), index_leaf_key(node, cell_num),
+          (num_cells - cell_num) * INDEX_KEY_SIZE);
+  memcpy(index_leaf_key(node, cell_num), key, INDEX_KEY_SIZE);
+  *leaf_node_num_cells(node) = num_cells + 1;
+}
+// 把一行写入所有已建的索引，正在建的索引先记到catch-up 缓冲(持有write_lock)
+void table_index_row(Table* table, Row* row) {
+  char* values[2] = {row->username, row->email};
+  FORLESS(2) {
+    if (table->indexes[i]) {
+      index_insert(table->indexes[i], values[i], row->id);
+    }
+    IndexCatchUp* catchup = &table->index_catchup[i];
+    if (catchup->building) {
+      if (catchup->num_keys == catchup->capacity) {
+        catchup->capacity = catchup->capacity ? catchup->capacity * 2 : 64;
+        catchup->keys =
+            realloc(catchup->keys, catchup->capacity * INDEX_KEY_SIZE);
+      }
+      index_key_make(catchup->keys + catchup->num_keys * INDEX_KEY_SIZE,
+                     values[i], row->id);
+      catchup->num_keys++;
+    }
+  }
+}
+// 索引文件与表文件同目录: <filename>.<column>.idx
+char* index_filename(Table* table, Projection column) {
+  char* name = index_column_name(column);
+  char* filename = malloc(strlen(table->filename) + strlen(name) + 6);
+  sprintf(filename, "%s.%s.idx", table->filename, name);
+  return filename;
+}
+// 旧版本value 上按columns 换成row 中的列
+void row_merge(Row* merged, void* value, Row* row, uint32_t columns) {
+  deserialize_row(merged, value);
+  if (columns & PROJECTION_USERNAME) {
+    memcpy(merged->username, row->username, USERNAME_SIZE);
+  }
+  if (columns & PROJECTION_EMAIL) {
+    memcpy(merged->email, row->email, EMAIL_SIZE);
+  }
+}
+// 写一行的方式
+typedef enum {
+  // insert: key 已存在时报重复
+  WRITE_INSERT,
+  // update: key 不存在时报不存在
+  WRITE_UPDATE,
+  // insert or replace: 存在就覆盖，不存在就插入
+  WRITE_UPSERT
+} WriteMode;
+
+// 只下降一次: 在table_find 到的叶子上判断key 是否存在，再按mode 插入或覆盖
+// columns 为row 中要写的列，其余列沿用旧版本(update set)
+// 旧版本是本事务写的就原地覆盖，其他读者看不到它;
+// 否则旧版本标记为被本事务删除，新版本插在它前面，正在读旧版本的读者不受影响
+ExecuteResult table_write_row(Table* table, Row* row, uint32_t columns,
+                              WriteMode mode) {
+  txn_begin(table);
+  Cursor* cursor = table_find(table, row->id);
+  ExecuteResult result = EXECUTE_SUCCESS;
+  uint32_t page_num, cell_num;
+  bool exists = cursor_find_live(cursor, row->id, &page_num, &cell_num);
+  if (exists && mode == WRITE_INSERT) {
+    result = EXECUTE_DUPLICATE_KEY;
+  } else if (!exists && mode == WRITE_UPDATE) {
+    result = EXECUTE_NOT_FOUND;
+  } else if (exists && *leaf_node_xmin(get_page(table->pager, page_num),
+                                        cell_num) == table->write_txn_id) {
+    void* node = get_page_for_write(table->pager, page_num);
+    Row merged;
+    row_merge(&merged, leaf_node_value(node, cell_num), row, columns);
+    // zone map 只增不减，旧值留下的范围只会让过滤少跳过一些叶子
+    leaf_node_write_version(table, node, cell_num, row->id, &merged);
+    table_index_row(table, &merged);
+  } else if ((result = leaf_node_make_room(cursor, row->id)) ==
+             EXECUTE_SUCCESS) {
+    Row merged = *row;
+    if (exists) {
+      // 回收旧版本会移动cell，重新定位最新版本
+      cursor_find_live(cursor, row->id, &page_num, &cell_num);
+      void* node = get_page_for_write(table->pager, page_num);
+      row_merge(&merged, leaf_node_value(node, cell_num), row, columns);
+      *leaf_node_xmax(node, cell_num) = table->write_txn_id;
+      node_refresh_count(table, page_num);
+    }
+    leaf_node_insert(cursor, row->id, &merged);
+    table_index_row(table, &merged);
+  }
+
+  free(cursor);
+  txn_commit(table);
+  return result;
+}
+ExecuteResult table_insert(Table* table, Row* row_to_insert) {
+  return table_write_row(table, row_to_insert,
+                         PROJECTION_USERNAME | PROJECTION_EMAIL, WRITE_INSERT);
+}
+// 叶子能放的最大key: 向上找到第一个不是right_child 的位置，取该位置的key
+// 一直是right_child 时没有上界
+uint32_t leaf_node_upper_bound(Table* table, uint32_t page_num) {
+  void* node = get_page(table->pager, page_num);
+  while (!is_node_root(node)) {
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page(table->pager, parent_page_num);
+    FORLESS(*internal_node_num_keys(parent)) {
+      if (*internal_node_child(parent, i) == page_num) {
+        return *internal_node_key(parent, i);
+      }
+    }
+    page_num = parent_page_num;
+    node = parent;
+  }
+  return UINT32_MAX;
+}
+// 叶子放不下一组新行: 旧cell 与新行归并到临时节点，一次切成最少的几个叶子
+// (cell 平均分配)，新叶子依次挂到父节点
+void leaf_node_split_rows(Table* table, uint32_t page_num, Row** rows,
+                          uint32_t num_rows) {
+  Pager* pager = table->pager;
+  void* old_node = get_page_for_write(pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(old_node);
+  uint32_t total = num_cells + num_rows;
+  void* merged = malloc(LEAF_NODE_HEADER_SIZE + total * LEAF_NODE_CELL_SIZE);
+  initialize_leaf_node(merged);
+  // 相同key 时新版本排在旧版本前面
+  uint32_t old = 0;
+  uint32_t next = 0;
+  FORLESS(total) {
+    if (next == num_rows ||
+        (old < num_cells && *leaf_node_key(old_node, old) < rows[next]->id)) {
+      memcpy(leaf_node_cell(merged, i), leaf_node_cell(old_node, old++),
+             LEAF_NODE_CELL_SIZE);
+    } else {
+      leaf_node_write_version(table, merged, i, rows[next]->id, rows[next]);
+      next++;
+    }
+  }
+
+  uint32_t old_max = num_cells > 0 ? get_node_max_key(old_node) : 0;
+  uint32_t next_leaf = *leaf_node_next_leaf(old_node);
+  uint32_t num_leaves =
+      (total + LEAF_NODE_MAX_CELLS - 1) / LEAF_NODE_MAX_CELLS;
+  uint32_t page_nums[num_leaves];
+  void* prev = NULL;
+  uint32_t start = 0;
+  FORLESS(num_leaves) {
+    void* leaf = old_node;
+    page_nums[i] = page_num;
+    if (i > 0) {
+      page_nums[i] = get_unused_page_num(pager);
+      leaf = get_page_for_write(pager, page_nums[i]);
+      initialize_leaf_node(leaf);
+      *node_parent(leaf) = *node_parent(old_node);
+      *leaf_node_next_leaf(prev) = page_nums[i];
+    }
+    uint32_t end = total * (i + 1) / num_leaves;
+    memcpy(leaf_node_cell(leaf, 0), leaf_node_cell(merged, start),
+           (end - start) * LEAF_NODE_CELL_SIZE);
+    *leaf_node_num_cells(leaf) = end - start;
+    leaf_node_zone_rebuild(leaf);
+    prev = leaf;
+    start = end;
+  }
+  *leaf_node_next_leaf(prev) = next_leaf;
+  free(merged);
+
+  uint32_t first = 1;
+  if (is_node_root(old_node)) {
+    create_new_root(table, page_nums[1]);
+    first = 2;
+  } else {
+    void* parent = get_page_for_write(pager, *node_parent(old_node));
+    update_internal_node_key(parent, old_max, get_node_max_key(old_node));
+  }
+  uint32_t parent_page_num = *node_parent(get_page(pager, page_nums[1]));
+  for (uint32_t i = first; i < num_leaves; i++) {
+    *node_parent(get_page(pager, page_nums[i])) = parent_page_num;
+    internal_node_insert(table, parent_page_num, page_nums[i]);
+  }
+  node_refresh_count(table, page_num);
+}
+// 把按id 排好序、已去掉重复的一组行写入叶子page_num
+// 需要切分但表已经没有页面时返回EXECUTE_FULL_TABLE，这组行都不写入
+ExecuteResult leaf_node_insert_rows(Table* table, uint32_t page_num,
+                                    Row** rows, uint32_t num_rows) {
+  void* node = get_page_for_write(table->pager, page_num);
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  if (num_cells + num_rows > LEAF_NODE_MAX_CELLS) {
+    leaf_node_prune(node, table_gc_horizon(table));
+    num_cells = *leaf_node_num_cells(node);
+  }
+  if (num_cells + num_rows > LEAF_NODE_MAX_CELLS) {
+    uint32_t num_leaves = (num_cells + num_rows + LEAF_NODE_MAX_CELLS - 1) /
+                          LEAF_NODE_MAX_CELLS;
+    if (!leaf_node_can_split(table, page_num, num_leaves - 1)) {
+      return EXECUTE_FULL_TABLE;
+    }
+    leaf_node_split_rows(table, page_num, rows, num_rows);
+    return EXECUTE_SUCCESS;
+  }
+  // 从后往前归并，每个旧cell 只移动一次
+  int32_t old = num_cells - 1;
+  int32_t next = num_rows - 1;
+  for (int32_t i = num_cells + num_rows - 1; next >= 0; i--) {
+    if (old >= 0 && *leaf_node_key(node, old) >= rows[next]->id) {
+      memcpy(leaf_node_cell(node, i), leaf_node_cell(node, old--),
+             LEAF_NODE_CELL_SIZE);
+    } else {
+      leaf_node_write_version(table, node, i, rows[next]->id, rows[next]);
+      next--;
+    }
+  }
+  *leaf_node_num_cells(node) = num_cells + num_rows;
+  node_refresh_count(table, page_num);
+  return EXECUTE_SUCCESS;
+}
+int row_pointer_compare(const void* a, const void* b) {
+  Row* row_a = *(Row**)a;
+  Row* row_b = *(Row**)b;
+  if (row_a->id != row_b->id) {
+    return row_a->id < row_b->id ? -1 : 1;
+  }
+  // 重复的id 保留批中靠前的那行
+  return row_a < row_b ? -1 : 1;
+}
+// 一批行一个事务: 按id 排序后，落在同一个叶子上的行只下降一次、一起写入
+// 与表中或批中靠前的行重复的跳过，表满时放不下的那组行也不插入，其余照常插入
+// results 不为NULL 时按rows 的顺序记录每行结果，inserted 不为NULL 时加上插入的行数
+// 有表满的行返回EXECUTE_FULL_TABLE，否则有重复的行返回EXECUTE_DUPLICATE_KEY
+ExecuteResult table_insert_batch(Table* table, Row* rows, uint32_t num_rows,
+                                 ExecuteResult* results, uint32_t* inserted) {
+  Row** sorted = malloc(num_rows * sizeof(Row*));
+  Row** accepted = malloc(num_rows * sizeof(Row*));
+  FORLESS(num_rows) { sorted[i] = &rows[i]; }
+  qsort(sorted, num_rows, sizeof(Row*), row_pointer_compare);
+
+  ExecuteResult result = EXECUTE_SUCCESS;
+  uint32_t next = 0;
+  txn_begin(table);
+  while (next < num_rows) {
+    Cursor* cursor = table_find(table, sorted[next]->id);
+    void* node = get_page(table->pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t upper = leaf_node_upper_bound(table, cursor->page_num);
+    uint32_t num_accepted = 0;
+    for (; next < num_rows && sorted[next]->id <= upper; next++) {
+      Row* row = sorted[next];
+      uint32_t page_num, cell_num;
+      cursor->cell_num = leaf_node_lower_bound(node, num_cells, row->id);
+      bool duplicate = (next > 0 && sorted[next - 1]->id == row->id) ||
+                       cursor_find_live(cursor, row->id, &page_num, &cell_num);
+      if (!duplicate) {
+        accepted[num_accepted++] = row;
+      } else if (result == EXECUTE_SUCCESS) {
+        result = EXECUTE_DUPLICATE_KEY;
+      }
+      if (results) {
+        results[row - rows] =
+            duplicate ? EXECUTE_DUPLICATE_KEY : EXECUTE_SUCCESS;
+      }
+    }
+    if (num_accepted > 0 &&
+        leaf_node_insert_rows(table, cursor->page_num, accepted,
+                              num_accepted) == EXECUTE_FULL_TABLE) {
+      result = EXECUTE_FULL_TABLE;
+      FORLESS(num_accepted) {
+        if (results) {
+          results[accepted[i] - rows] = EXECUTE_FULL_TABLE;
+        }
+      }
+    } else if (num_accepted > 0) {
+      FORLESS(num_accepted) { table_index_row(table, accepted[i]); }
+      if (inserted) {
+        *inserted += num_accepted;
+      }
+    }
+    free(cursor);
+    // 下一个叶子的table_find 是乐观读，要先解锁这一组改过的页面
+    pager_release_writes(table->pager);
+  }
+  txn_commit(table);
+
+  free(sorted);
+  free(accepted);
+  return result;
+}
+// insert values: 整条语句一批插入，重复的行跳过，其余照常插入
+ExecuteResult execute_insert_values(Statement* statement, Table* table) {
+  Row* rows = malloc(statement->num_values * sizeof(Row));
+  statement_values(statement, rows);
+  ExecuteResult result =
+      table_insert_batch(table, rows, statement->num_values, NULL, NULL);
+  free(rows);
+  return result;
+}
+ExecuteResult execute_insert(Statement* statement, Table* table) {
+  if (statement->num_values > 0) {
+    return execute_insert_values(statement, table);
+  }
+  return table_insert(table, &statement->row_to_insert);
+}
+// update id username email 整行更新，update set 只更新列出的列
+ExecuteResult execute_update(Statement* statement, Table* table) {
+  return table_write_row(table, &statement->row_to_insert,
+                         statement->update_columns, WRITE_UPDATE);
+}
+// insert or replace
+ExecuteResult execute_upsert(Statement* statement, Table* table) {
+  return table_write_row(table, &statement->row_to_insert,
+                         PROJECTION_USERNAME | PROJECTION_EMAIL, WRITE_UPSERT);
+}
+// 删除只设置xmax，版本在之后改写叶子时回收
+ExecuteResult table_delete(Table* table, uint32_t key) {
+  txn_begin(table);
+  Cursor* cursor = table_find(table, key);
+  ExecuteResult result = EXECUTE_SUCCESS;
+  uint32_t page_num, cell_num;
+  if (cursor_find_live(cursor, key, &page_num, &cell_num)) {
+    void* node = get_page_for_write(table->pager, page_num);
+    *leaf_node_xmax(node, cell_num) = table->write_txn_id;
+    node_refresh_count(table, page_num);
+  } else {
+    result = EXECUTE_NOT_FOUND;
+  }
+
+  free(cursor);
+  txn_commit(table);
+  return result;
+}
+ExecuteResult execute_delete(Statement* statement, Table* table) {
+  return table_delete(table, statement->row_to_insert.id);
+}
+// 读者: 从cursor 开始沿key 的版本找对txn_id 可见的那个
+// 版本可能延续到下一个叶子，换叶子时同样做lock coupling
+// 返回1 找到(cursor 指向该版本，调用者pin 页面时校验版本)，0 不存在，
+// -1 期间有写者修改，需要重新下降
+int cursor_find_visible(Cursor* cursor, uint32_t key, uint32_t txn_id) {
+  Pager* pager = cursor->table->pager;
+  while (true) {
+    void* node = get_page(pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells > LEAF_NODE_MAX_CELLS) {
+      return -1;
+    }
+    for (uint32_t i = cursor->cell_num; i < num_cells; i++) {
+      if (*leaf_node_key(node, i) != key) {
+        return cursor_validate(cursor) ? 0 : -1;
+      }
+      if (leaf_node_visible(node, i, txn_id)) {
+        cursor->cell_num = i;
+        return 1;
+      }
+    }
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    if (next_page_num == 0 || next_page_num >= TABLE_MAX_PAGES) {
+      return cursor_validate(cursor) ? 0 : -1;
+    }
+    uint64_t next_version = node_read_begin(pager, next_page_num);
+    if (!cursor_validate(cursor)) {
+      return -1;
+    }
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
+    cursor->version = next_version;
+  }
+}
+// 行视图: 直接指向被pin 住的叶子页面，字段在访问时才读取
+// 视图存在期间页面不会被原地修改，用完调用row_view_release
+typedef struct {
+  void* page;
+  void* value;
+} RowView;
+
+// 多点查同时进行的查找数
+const uint32_t LOOKUP_WINDOW = 32;
+// 多点查找到一行: index 为key 在请求中的位置，view 只在调用期间有效
+typedef void (*MultiGetVisit)(void* arg, uint32_t index, RowView* view);
+// 多点查中一个进行中的查找: 像协程一样，需要的页面不在内存时让出，
+// 页面读入后从page_num 继续
+typedef struct {
+  uint32_t key;
+  uint32_t index;
+  uint32_t txn_id;
+  uint32_t page_num;
+  uint64_t version;
+  // page_num 不在内存中，已经提交了预读
+  bool waiting;
+} Lookup;
+
+uint32_t row_view_id(RowView* view) {
+  return *(uint32_t*)(view->value + ID_OFFSET);
+}
+char* row_view_username(RowView* view) { return view->value + USERNAME_OFFSET; }
+char* row_view_email(RowView* view) { return view->value + EMAIL_OFFSET; }
+void row_view_release(RowView* view) {
+  pager_unpin(view->page);
+  view->page = NULL;
+  view->value = NULL;
+}
+// 输出select 的一行: 有callback 时交给调用者，否则只格式化select 需要的列
+void statement_emit(Statement* statement, uint32_t id, char* username,
+                    char* email) {
+  if (statement->stopped) {
+    return;
+  }
+  if (statement->callback) {
+    DBRowView row;
+    row.id = id;
+    row.username = statement->projection & PROJECTION_USERNAME ? username : NULL;
+    row.email = statement->projection & PROJECTION_EMAIL ? email : NULL;
+    statement->stopped = !statement->callback(statement->callback_arg, &row);
+    return;
+  }
+  putchar('(');
+  FORLESS(statement->num_columns) {
+    if (i > 0) {
+      putchar(' ');
+    }
+    switch (statement->columns[i]) {
+    case PROJECTION_ID:
+      printf("%d", id);
+      break;
+    case PROJECTION_USERNAME:
+      fputs(username, stdout);
+      break;
+    case PROJECTION_EMAIL:
+      fputs(email, stdout);
+      break;
+    }
+  }
+  puts(")");
+}
+// count/min/max/rank 的一个结果值
+void statement_emit_value(Statement* statement, uint32_t value) {
+  if (statement->callback) {
+    statement_emit(statement, value, NULL, NULL);
+  } else {
+    printf("%d", value);
+  }
+}
+void print_row_view(RowView* view, Statement* statement) {
+  statement_emit(statement, row_view_id(view), row_view_username(view),
+                 row_view_email(view));
+}
+// 从cursor 开始找txn_id 可见的版本，找到时pin 住所在叶子
+// 返回值同cursor_find_visible
+// 点查不登记读视图: 没找到时如果期间又有提交，txn_id 可见的版本可能已被回收，
+// 也要换新的事务号重查
+int cursor_pin_visible(Cursor* cursor, uint32_t key, uint32_t txn_id,
+                       RowView* view) {
+  int found = cursor_find_visible(cursor, key, txn_id);
+  if (found == 0 && table_read_txn(cursor->table) != txn_id) {
+    found = -1;
+  }
+  if (found == 1) {
+    void* page =
+        pager_pin(cursor->table->pager, cursor->page_num, cursor->version);
+    if (page) {
+      view->page = page;
+      view->value = leaf_node_value(page, cursor->cell_num);
+    } else {
+      found = -1;
+    }
+  }
+  return found;
+}
+// 点查: 不加锁下降，pin 住可见版本所在的叶子时校验版本，被修改过就重新下降
+bool table_lookup_view(Table* table, uint32_t key, RowView* view) {
+  while (true) {
+    uint32_t phase = pager_read_enter(table->pager);
+    uint32_t txn_id = table_read_txn(table);
+    Cursor* cursor = table_find(table, key);
+    int found = cursor_pin_visible(cursor, key, txn_id, view);
+    free(cursor);
+    pager_read_exit(table->pager, phase);
+    if (found >= 0) {
+      return found;
+    }
+  }
+}
+// 需要整行拷贝时使用
+bool table_lookup(Table* table, uint32_t key, Row* row) {
+  RowView view;
+  if (!table_lookup_view(table, key, &view)) {
+    return false;
+  }
+  deserialize_row(row, view.value);
+  row_view_release(&view);
+  return true;
+}
+// 预取页面的header 和二分查找第一次访问的位置
+void node_prefetch(Pager* pager, uint32_t page_num) {
+  char* page =
+      atomic_load_explicit(&pager->pages[page_num], memory_order_acquire);
+  if (page) {
+    __builtin_prefetch(page);
+    __builtin_prefetch(page + PAGE_SIZE / 2);
+  }
+}
+// 交错下降的一步: 从内部节点进入key 所在的子节点
+// 已经到叶子返回false; 校验失败时page_num 置为TABLE_MAX_PAGES
+bool node_descend_step(Table* table, uint32_t* page_num, uint64_t* version,
+                       uint32_t key) {
+  Pager* pager = table->pager;
+  void* node = get_page(pager, *page_num);
+  if (get_node_type(node) == NODE_LEAF) {
+    return false;
+  }
+  uint32_t num_keys = *internal_node_num_keys(node);
+  uint32_t child_page_num = TABLE_MAX_PAGES;
+  if (num_keys <= INTERNAL_NODE_MAX_CELLS) {
+    uint32_t child_index = internal_node_find_child(node, key);
+    child_page_num = child_index >= num_keys
+                         ? *internal_node_right_child(node)
+                         : *internal_node_cell(node, child_index);
+  }
+  if (child_page_num >= TABLE_MAX_PAGES) {
+    *page_num = TABLE_MAX_PAGES;
+    return false;
+  }
+  uint64_t child_version = node_read_begin(pager, child_page_num);
+  if (!node_read_validate(pager, *page_num, *version)) {
+    *page_num = TABLE_MAX_PAGES;
+    return false;
+  }
+  *page_num = child_page_num;
+  *version = child_version;
+  return true;
+}
+// 升序排序，小段用插入排序
+// 几十个key 时qsort 每次比较的函数调用比查找本身还贵
+void sort_uint64(uint64_t* a, uint32_t n) {
+  while (n > 16) {
+    uint64_t pivot = a[n / 2];
+    uint32_t i = 0;
+    uint32_t j = n - 1;
+    while (true) {
+      while (a[i] < pivot) {
+        i++;
+      }
+      while (a[j] > pivot) {
+        j--;
+      }
+      if (i >= j) {
+        break;
+      }
+      uint64_t t = a[i];
+      a[i++] = a[j];
+      a[j--] = t;
+    }
+    sort_uint64(a, j + 1);
+    a += j + 1;
+    n -= j + 1;
+  }
+  for (uint32_t i = 1; i < n; i++) {
+    uint64_t t = a[i];
+    uint32_t j = i;
+    for (; j > 0 && a[j - 1] > t; j--) {
+      a[j] = a[j - 1];
+    }
+    a[j] = t;
+  }
+}
+// 查找进入page_num: 页面在内存中就预取到CPU 缓存，否则提交预读后让出
+void lookup_enter(Pager* pager, Lookup* lookup, uint32_t page_num,
+                  uint64_t version) {
+  lookup->page_num = page_num;
+  lookup->version = version;
+  lookup->waiting = pager->pages[page_num] == NULL;
+  if (lookup->waiting) {
+    pager_prefetch_async(pager, page_num);
+  } else {
+    node_prefetch(pager, page_num);
+  }
+}
+// 从root 开始，校验失败时也从这里重新开始
+void lookup_start(Table* table, Lookup* lookup) {
+  uint32_t root_page_num = table->root_page_num;
+  lookup->txn_id = table_read_txn(table);
+  lookup_enter(table->pager, lookup, root_page_num,
+               node_read_begin(table->pager, root_page_num));
+}
+// 推进一步: 等的页面还没读完就继续等，内部节点下降一层，到叶子后查找可见版本
+// 查找结束返回true
+bool lookup_step(Table* table, Lookup* lookup, MultiGetVisit visit,
+                 void* arg) {
+  Pager* pager = table->pager;
+  if (lookup->waiting) {
+    if (!pager_load(pager, lookup->page_num, true)) {
+      return false;
+    }
+    lookup->waiting = false;
+  }
+  uint32_t page_num = lookup->page_num;
+  uint64_t version = lookup->version;
+  if (node_descend_step(table, &page_num, &version, lookup->key)) {
+    lookup_enter(pager, lookup, page_num, version);
+    return false;
+  }
+  // 与leaf_node_find 相同，cursor 放在栈上
+  int found = -1;
+  RowView view;
+  if (page_num != TABLE_MAX_PAGES) {
+    void* node = get_page(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells <= LEAF_NODE_MAX_CELLS) {
+      Cursor cursor = {table, page_num, 0, false, version};
+      cursor.cell_num = leaf_node_lower_bound(node, num_cells, lookup->key);
+      found = cursor_pin_visible(&cursor, lookup->key, lookup->txn_id, &view);
+    }
+  }
+  // 下降期间有写者修改，从root 重新查找
+  if (found < 0) {
+    lookup_start(table, lookup);
+    return false;
+  }
+  if (found == 1) {
+    visit(arg, lookup->index, &view);
+    row_view_release(&view);
+  }
+  return true;
+}
+// 多点查: key 排序后最多LOOKUP_WINDOW 个查找同时进行，轮流各推进一层
+// 页面在内存中时每层选好子节点就预取，一个查找等待缓存缺失时CPU 在推进其他查找;
+// 页面不在内存中时提交预读后让出，线程不阻塞在磁盘读上，
+// 只有全部查找都在等页面时才阻塞读入其中一页
+// 找到的行趁叶子还在缓存里交给visit，不存在的key 不调用
+// 与table_lookup_view 一样不登记读视图，不阻塞旧版本回收
+void table_multi_lookup(Table* table, const uint32_t* keys, uint32_t num_keys,
+                        MultiGetVisit visit, void* arg) {
+  Pager* pager = table->pager;
+  // 高32位是key，低32位是在请求中的位置
+  uint64_t* sorted = malloc(num_keys * sizeof(uint64_t));
+  FORLESS(num_keys) { sorted[i] = (uint64_t)keys[i] << 32 | i; }
+  sort_uint64(sorted, num_keys);
+
+  uint32_t phase = pager_read_enter(pager);
+  Lookup lookups[LOOKUP_WINDOW];
+  uint32_t num_active = 0;
+  uint32_t next = 0;
+  while (next < num_keys || num_active > 0) {
+    for (; num_active < LOOKUP_WINDOW && next < num_keys; next++) {
+      Lookup* lookup = &lookups[num_active++];
+      lookup->key = sorted[next] >> 32;
+      lookup->index = (uint32_t)sorted[next];
+      lookup_start(table, lookup);
+    }
+    // 结束的查找由最后一个补位
+    bool progressed = false;
+    for (uint32_t i = 0; i < num_active;) {
+      bool waiting = lookups[i].waiting;
+      if (lookup_step(table, &lookups[i], visit, arg)) {
+        lookups[i] = lookups[--num_active];
+        progressed = true;
+        continue;
+      }
+      progressed = progressed || !waiting || !lookups[i].waiting;
+      i++;
+    }
+    if (!progressed) {
+      get_page(pager, lookups[0].page_num);
+    }
+  }
+  pager_read_exit(pager, phase);
+  free(sorted);
+}
+// 比较n 个字节，SSE2 下每次比较16 字节
+bool bytes_equal(const char* a, const char* b, uint32_t n) {
+  uint32_t i = 0;
+#ifdef __SSE2__
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xFFFF) {
+      return false;
+    }
+  }
+#endif
+  return memcmp(a + i, b + i, n - i) == 0;
+}
+// s[0, len) 中是否包含p
+// SSE2 下一次检查16 个起点: 首字节和末字节都相同的起点才做完整比较
+bool bytes_contains(const char* s, uint32_t len, const char* p,
+                    uint32_t plen) {
+  if (plen == 0) {
+    return true;
+  }
+  if (plen > len) {
+    return false;
+  }
+  // 最后一个可能的起点
+  uint32_t last = len - plen;
+  uint32_t i = 0;
+#ifdef __SSE2__
+  __m128i first = _mm_set1_epi8(p[0]);
+  __m128i tail = _mm_set1_epi8(p[plen - 1]);
+  // 两次加载都不超过s + len
+  for (; i + 16 <= last + 1; i += 16) {
+    __m128i head_bytes = _mm_loadu_si128((const __m128i*)(s + i));
+    __m128i tail_bytes = _mm_loadu_si128((const __m128i*)(s + i + plen - 1));
+    uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(head_bytes, first), _mm_cmpeq_epi8(tail_bytes, tail)));
+    while (mask) {
+      uint32_t bit = __builtin_ctz(mask);
+      if (bytes_equal(s + i + bit, p, plen)) {
+        return true;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  for (; i <= last; i++) {
+    if (s[i] == p[0] && bytes_equal(s + i, p, plen)) {
+      return true;
+    }
+  }
+  return false;
+}
+// 直接在页面里的定长字段上判断谓词，不匹配的行不会被拷贝或输出
+bool filter_match(Statement* statement, void* value) {
+  char* field;
+  uint32_t size;
+  if (statement->filter_column == PROJECTION_USERNAME) {
+    field = value + USERNAME_OFFSET;
+    size = USERNAME_SIZE;
+  } else {
+    field = value + EMAIL_OFFSET;
+    size = EMAIL_SIZE;
+  }
+  char* pattern = statement->filter_pattern;
+  uint32_t plen = statement->filter_length;
+  // 字段以'\0' 结尾，比较到plen 为止不会越过字段
+  switch (statement->filter_op) {
+  case FILTER_NONE:
+    return true;
+  case FILTER_EQUAL:
+    return plen < size && field[plen] == '\0' &&
+           bytes_equal(field, pattern, plen);
+  case FILTER_PREFIX:
+    return plen < size && bytes_equal(field, pattern, plen);
+  case FILTER_SUFFIX: {
+    uint32_t len = strnlen(field, size);
+    return len >= plen && bytes_equal(field + len - plen, pattern, plen);
+  }
+  case FILTER_CONTAINS:
+    return bytes_contains(field, strnlen(field, size), pattern, plen);
+  }
+  return false;
+}
+// 批量执行: 一次取出一个叶子中可见的行，按列存放，只填select 需要的列
+// 字符串直接指向页面，不拷贝; 批处理期间页面被pin 住或属于快照，不会被修改
+typedef struct {
+  uint32_t num_rows;
+  uint32_t ids[LEAF_NODE_MAX_CELLS];
+  char* usernames[LEAF_NODE_MAX_CELLS];
+  char* emails[LEAF_NODE_MAX_CELLS];
+} RowBatch;
+
+// 把node 从from 开始、key 在[lo, hi] 内且对txn_id 可见的行放进batch
+// 不满足过滤条件的行跳过，projection 之外的列不填
+// 遇到大于hi 的key 返回true，表示范围已经扫完
+bool row_batch_fill(RowBatch* batch, void* node, uint32_t from,
+                    uint32_t txn_id, uint32_t lo, uint32_t hi,
+                    Statement* statement) {
+  uint32_t projection = statement->projection;
+  batch->num_rows = 0;
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  for (uint32_t i = from; i < num_cells; i++) {
+    uint32_t key = *leaf_node_key(node, i);
+    if (key > hi) {
+      return true;
+    }
+    if (key < lo || !leaf_node_visible(node, i, txn_id)) {
+      continue;
+    }
+    void* value = leaf_node_value(node, i);
+    if (statement->filter_op != FILTER_NONE && !filter_match(statement, value)) {
+      continue;
+    }
+    batch->ids[batch->num_rows] = key;
+    if (projection & PROJECTION_USERNAME) {
+      batch->usernames[batch->num_rows] = value + USERNAME_OFFSET;
+    }
+    if (projection & PROJECTION_EMAIL) {
+      batch->emails[batch->num_rows] = value + EMAIL_OFFSET;
+    }
+    batch->num_rows++;
+  }
+  return false;
+}
+// 去掉batch 的前offset 行，最多保留limit 行，两者减去消耗掉的行数
+void row_batch_limit(RowBatch* batch, uint32_t* offset, uint32_t* limit) {
+  uint32_t skip = *offset < batch->num_rows ? *offset : batch->num_rows;
+  uint32_t keep = batch->num_rows - skip;
+  if (keep > *limit) {
+    keep = *limit;
+  }
+  if (skip > 0) {
+    memmove(batch->ids, batch->ids + skip, keep * sizeof(uint32_t));
+    memmove(batch->usernames, batch->usernames + skip, keep * sizeof(char*));
+    memmove(batch->emails, batch->emails + skip, keep * sizeof(char*));
+  }
+  batch->num_rows = keep;
+  *offset -= skip;
+  *limit -= keep;
+}
+void row_batch_print(RowBatch* batch, Statement* statement) {
+  // 打印且只有id 时不需要逐列判断
+  if (statement->callback == NULL && statement->projection == PROJECTION_ID) {
+    FORLESS(batch->num_rows) { printf("(%d)\n", batch->ids[i]); }
+    return;
+  }
+  FORLESS(batch->num_rows) {
+    statement_emit(statement, batch->ids[i], batch->usernames[i],
+                   batch->emails[i]);
+  }
+}
+
+// 并行扫描的一个分区: key 范围[lo, hi]，worker 把每个叶子的结果存为一个batch
+typedef struct {
+  uint32_t lo;
+  uint32_t hi;
+  RowBatch* batches;
+  uint32_t num_batches;
+  uint32_t capacity;
+  bool done;
+} ScanPartition;
+
+typedef struct {
+  Statement* statement;
+  // 所有worker 共享同一个快照，batch 指向的页面在释放快照前都有效
+  Table* snapshot;
+  ScanPartition* partitions;
+  uint32_t num_partitions;
+  uint32_t capacity;
+  _Atomic uint32_t next_partition;
+  _Atomic uint32_t leaves;
+  _Atomic uint32_t skipped_leaves;
+  bool ordered;
+  // 有序输出时主线程等待分区完成; 无序输出时串行打印
+  pthread_mutex_t lock;
+  pthread_cond_t partition_done;
+} ParallelScan;
+
+void parallel_scan_add_partition(ParallelScan* scan, uint32_t lo,
+                                 uint32_t hi) {
+  if (scan->num_partitions == scan->capacity) {
+    scan->capacity = scan->capacity ? scan->capacity * 2 : 16;
+    scan->partitions =
+        realloc(scan->partitions, scan->capacity * sizeof(ScanPartition));
+  }
+  ScanPartition* part = &scan->partitions[scan->num_partitions++];
+  part->lo = lo;
+  part->hi = hi;
+  part->batches = NULL;
+  part->num_batches = 0;
+  part->capacity = 0;
+  part->done = false;
+}
+// 按root 和第二层内部节点的子节点切分key 空间
+// 子节点i 覆盖(key[i-1], key[i]]，right_child 覆盖到上层给的hi
+void parallel_scan_split(ParallelScan* scan, uint32_t page_num, uint32_t lo,
+                         uint32_t hi, uint32_t depth) {
+  void* node = get_page(scan->snapshot->pager, page_num);
+  if (get_node_type(node) == NODE_LEAF || depth == 2) {
+    parallel_scan_add_partition(scan, lo, hi);
+    return;
+  }
+  uint32_t num_keys = *internal_node_num_keys(node);
+  uint32_t child_lo = lo;
+  for (uint32_t i = 0; i <= num_keys; i++) {
+    uint32_t child_hi = i == num_keys ? hi : *internal_node_key(node, i);
+    if (child_lo <= child_hi) {
+      parallel_scan_split(scan, *internal_node_child(node, i), child_lo,
+                          child_hi, depth + 1);
+    }
+    if (child_hi == UINT32_MAX) {
+      break;
+    }
+    child_lo = child_hi + 1;
+  }
+}
+RowBatch* parallel_scan_next_batch(ScanPartition* part) {
+  if (part->num_batches == part->capacity) {
+    part->capacity = part->capacity ? part->capacity * 2 : 8;
+    part->batches = realloc(part->batches, part->capacity * sizeof(RowBatch));
+  }
+  return &part->batches[part->num_batches++];
+}
+// 每个worker 领取分区，用自己的Cursor 从lo 开始逐个叶子取batch 直到hi
+void* parallel_scan_worker(void* arg) {
+  ParallelScan* scan = arg;
+  Table* snapshot = scan->snapshot;
+  uint32_t txn_id = atomic_load(&snapshot->committed_txn_id);
+  while (true) {
+    uint32_t index = atomic_fetch_add(&scan->next_partition, 1);
+    if (index >= scan->num_partitions) {
+      break;
+    }
+    ScanPartition* part = &scan->partitions[index];
+    Cursor* cursor = table_find(snapshot, part->lo);
+    while (true) {
+      void* node = get_page(snapshot->pager, cursor->page_num);
+      atomic_fetch_add(&scan->leaves, 1);
+      bool finished = false;
+      if (leaf_node_zone_may_match(node, scan->statement)) {
+        RowBatch* batch = parallel_scan_next_batch(part);
+        finished = row_batch_fill(batch, node, cursor->cell_num, txn_id,
+                                  part->lo, part->hi, scan->statement);
+        if (batch->num_rows == 0) {
+          part->num_batches--;
+        }
+      } else {
+        atomic_fetch_add(&scan->skipped_leaves, 1);
+        // 跳过的叶子也要判断是否已经越过hi
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        finished = num_cells > 0 &&
+                   *leaf_node_key(node, num_cells - 1) > part->hi;
+      }
+      uint32_t next_page_num = *leaf_node_next_leaf(node);
+      if (finished || next_page_num == 0) {
+        break;
+      }
+      cursor->page_num = next_page_num;
+      cursor->cell_num = 0;
+    }
+    free(cursor);
+
+    pthread_mutex_lock(&scan->lock);
+    if (!scan->ordered) {
+      FORLESS(part->num_batches) {
+        row_batch_print(&part->batches[i], scan->statement);
+      }
+    }
+    part->done = true;
+    pthread_cond_broadcast(&scan->partition_done);
+    pthread_mutex_unlock(&scan->lock);
+  }
+  return NULL;
+}
+// 并行全表扫描: 在快照上按内部节点切分key 空间，多个worker 同时扫描
+// ordered 时主线程按分区顺序输出，否则谁先扫完谁先输出
+ExecuteResult execute_parallel_select(Statement* statement, Table* table) {
+  ParallelScan scan;
+  scan.statement = statement;
+  scan.snapshot = table_snapshot(table);
+  scan.partitions = NULL;
+  scan.num_partitions = 0;
+  scan.capacity = 0;
+  atomic_init(&scan.next_partition, 0);
+  atomic_init(&scan.leaves, 0);
+  atomic_init(&scan.skipped_leaves, 0);
+  scan.ordered = !statement->unordered;
+  pthread_mutex_init(&scan.lock, NULL);
+  pthread_cond_init(&scan.partition_done, NULL);
+  parallel_scan_split(&scan, scan.snapshot->root_page_num, 0, UINT32_MAX, 0);
+
+  uint32_t num_threads = table->scan_threads;
+  if (num_threads > scan.num_partitions) {
+    num_threads = scan.num_partitions;
+  }
+  pthread_t threads[num_threads];
+  FORLESS(num_threads) {
+    pthread_create(&threads[i], NULL, parallel_scan_worker, &scan);
+  }
+  if (scan.ordered) {
+    FORLESS(scan.num_partitions) {
+      ScanPartition* part = &scan.partitions[i];
+      pthread_mutex_lock(&scan.lock);
+      while (!part->done) {
+        pthread_cond_wait(&scan.partition_done, &scan.lock);
+      }
+      pthread_mutex_unlock(&scan.lock);
+      for (uint32_t j = 0; j < part->num_batches; j++) {
+        row_batch_print(&part->batches[j], statement);
+      }
+    }
+  }
+  FORLESS(num_threads) { pthread_join(threads[i], NULL); }
+
+  atomic_store(&table->scan_leaves, atomic_load(&scan.leaves));
+  atomic_store(&table->scan_skipped_leaves, atomic_load(&scan.skipped_leaves));
+  FORLESS(scan.num_partitions) { free(scan.partitions[i].batches); }
+  free(scan.partitions);
+  pthread_mutex_destroy(&scan.lock);
+  pthread_cond_destroy(&scan.partition_done);
+  table_release_snapshot(scan.snapshot);
+  return EXECUTE_SUCCESS;
+}
+// min/max: 沿子树计数非0 的最左/最右子节点下降，叶子中取第一个/最后一个未删除的版本
+// 返回false 表示表为空
+bool table_edge_key(Table* table, bool rightmost, uint32_t* key) {
+  void* node = get_page(table->pager, table->root_page_num);
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t child_num = rightmost ? num_keys : 0;
+    while (*internal_node_count(node, child_num) == 0) {
+      if (rightmost ? child_num == 0 : child_num == num_keys) {
+        return false;
+      }
+      child_num += rightmost ? -1 : 1;
+    }
+    node = get_page(table->pager, *internal_node_child(node, child_num));
+  }
+  uint32_t num_cells = *leaf_node_num_cells(node);
+  FORLESS(num_cells) {
+    uint32_t cell_num = rightmost ? num_cells - 1 - i : i;
+    if (*leaf_node_xmax(node, cell_num) == TXN_NONE) {
+      *key = *leaf_node_key(node, cell_num);
+      return true;
+    }
+  }
+  return false;
+}
+// 第n 行(从0开始)的key: 按子树计数跳过整棵子树，只访问root 到一个叶子的路径
+// 调用者持有write_lock，超出行数返回false
+bool table_nth_key(Table* table, uint32_t n, uint32_t* key) {
+  void* node = get_page(table->pager, table->root_page_num);
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t child_num = 0;
+    while (n >= *internal_node_count(node, child_num)) {
+      n -= *internal_node_count(node, child_num);
+      if (child_num++ == num_keys) {
+        return false;
+      }
+    }
+    node = get_page(table->pager, *internal_node_child(node, child_num));
+  }
+  FORLESS(*leaf_node_num_cells(node)) {
+    if (*leaf_node_xmax(node, i) == TXN_NONE && n-- == 0) {
+      *key = *leaf_node_key(node, i);
+      return true;
+    }
+  }
+  return false;
+}
+// key 之前的行数: 累加左边兄弟子树的计数，调用者持有write_lock
+uint32_t table_rank(Table* table, uint32_t key) {
+  uint32_t rank = 0;
+  void* node = get_page(table->pager, table->root_page_num);
+  while (get_node_type(node) == NODE_INTERNAL) {
+    uint32_t child_num = internal_node_find_child(node, key);
+    FORLESS(child_num) { rank += *internal_node_count(node, i); }
+    node = get_page(table->pager, *internal_node_child(node, child_num));
+  }
+  FORLESS(*leaf_node_num_cells(node)) {
+    if (*leaf_node_key(node, i) >= key) {
+      break;
+    }
+    rank += *leaf_node_xmax(node, i) == TXN_NONE;
+  }
+  return rank;
+}
+ExecuteResult execute_rank(Statement* statement, Table* table) {
+  table_write_lock(table);
+  uint32_t key = statement->id_to_select;
+  Cursor* cursor = table_find(table, key);
+  uint32_t page_num, cell_num;
+  if (cursor_find_live(cursor, key, &page_num, &cell_num)) {
+    if (statement->callback) {
+      statement_emit_value(statement, table_rank(table, key) + 1);
+    } else {
+      printf("(%d)\n", table_rank(table, key) + 1);
+    }
+  }
+  free(cursor);
+  table_write_unlock(table);
+  return EXECUTE_SUCCESS;
+}
+// 聚合持有write_lock: 计数只包含已提交的行(显式事务中还包括本事务的修改)
+// 只访问root 到一个叶子的路径
+ExecuteResult execute_aggregate(Statement* statement, Table* table) {
+  table_write_lock(table);
+  bool print = statement->callback == NULL;
+  if (print) {
+    putchar('(');
+  }
+  FORLESS(statement->num_aggregates) {
+    if (print && i > 0) {
+      putchar(' ');
+    }
+    uint32_t key;
+    switch (statement->aggregates[i]) {
+    case AGGREGATE_COUNT:
+      statement_emit_value(statement,
+                           node_live_count(get_page(table->pager,
+                                                    table->root_page_num)));
+      break;
+    case AGGREGATE_MIN:
+    case AGGREGATE_MAX:
+      // 空表时打印NULL，回调则不输出
+      if (table_edge_key(table, statement->aggregates[i] == AGGREGATE_MAX,
+                         &key)) {
+        statement_emit_value(statement, key);
+      } else if (print) {
+        printf("NULL");
+      }
+      break;
+    }
+  }
+  if (print) {
+    puts(")");
+  }
+  table_write_unlock(table);
+  return EXECUTE_SUCCESS;
+}
+// 并行建索引: 每个worker 在快照上扫描分区，取出(value, id) 后各自排序
+typedef struct {
+  ParallelScan* scan;
+  Projection column;
+  char* keys;
+  uint32_t num_keys;
+  uint32_t capacity;
+} IndexBuildWorker;
+
+int index_key_compare_qsort(const void* a, const void* b) {
+  return index_key_compare(a, b);
+}
+void* index_build_worker(void* arg) {
+  IndexBuildWorker* worker = arg;
+  ParallelScan* scan = worker->scan;
+  Table* snapshot = scan->snapshot;
+  uint32_t txn_id = atomic_load(&snapshot->committed_txn_id);
+  uint32_t value_offset =
+      worker->column == PROJECTION_USERNAME ? USERNAME_OFFSET : EMAIL_OFFSET;
+  while (true) {
+    uint32_t index = atomic_fetch_add(&scan->next_partition, 1);
+    if (index >= scan->num_partitions) {
+      break;
+    }
+    ScanPartition* part = &scan->partitions[index];
+    Cursor* cursor = table_find(snapshot, part->lo);
+    bool finished = false;
+    while (!finished) {
+      void* node = get_page(snapshot->pager, cursor->page_num);
+      uint32_t num_cells = *leaf_node_num_cells(node);
+      for (uint32_t i = cursor->cell_num; i < num_cells; i++) {
+        uint32_t key = *leaf_node_key(node, i);
+        if (key > part->hi) {
+          finished = true;
+          break;
+        }
+        if (key < part->lo || !leaf_node_visible(node, i, txn_id)) {
+          continue;
+        }
+        if (worker->num_keys == worker->capacity) {
+          worker->capacity = worker->capacity ? worker->capacity * 2 : 256;
+          worker->keys =
+              realloc(worker->keys, worker->capacity * INDEX_KEY_SIZE);
+        }
+        index_key_make(worker->keys + worker->num_keys * INDEX_KEY_SIZE,
+                       leaf_node_value(node, i) + value_offset, key);
+        worker->num_keys++;
+      }
+      uint32_t next_page_num = *leaf_node_next_leaf(node);
+      if (next_page_num == 0) {
+        break;
+      }
+      cursor->page_num = next_page_num;
+      cursor->cell_num = 0;
+    }
+    free(cursor);
+  }
+  // 分到的范围里没有行时keys 还是NULL
+  if (worker->num_keys > 0) {
+    qsort(worker->keys, worker->num_keys, INDEX_KEY_SIZE,
+          index_key_compare_qsort);
+  }
+  return NULL;
+}
+// 多路归并各worker 的有序结果
+char* index_build_merge(IndexBuildWorker* workers, uint32_t num_workers,
+                        uint32_t* num_keys) {
+  uint32_t total = 0;
+  FORLESS(num_workers) { total += workers[i].num_keys; }
+  char* keys = malloc((total ? total : 1) * INDEX_KEY_SIZE);
+  uint32_t positions[num_workers];
+  memset(positions, 0, sizeof(positions));
+  for (uint32_t n = 0; n < total; n++) {
+    int smallest = -1;
+    FORLESS(num_workers) {
+      if (positions[i] == workers[i].num_keys) {
+        continue;
+      }
+      char* key = workers[i].keys + positions[i] * INDEX_KEY_SIZE;
+      if (smallest < 0 ||
+          index_key_compare(key, workers[smallest].keys +
+                                     positions[smallest] * INDEX_KEY_SIZE) <
+              0) {
+        smallest = i;
+      }
+    }
+    memcpy(keys + n * INDEX_KEY_SIZE,
+           workers[smallest].keys + positions[smallest] * INDEX_KEY_SIZE,
+           INDEX_KEY_SIZE);
+    positions[smallest]++;
+  }
+  *num_keys = total;
+  return keys;
+}
+// 自底向上建树: 有序的key 依次填满叶子，root(page 0) 指向所有叶子
+// 页数上限100，叶子数不会超过一个内部节点能容纳的子节点数
+void index_bulk_load(Pager* pager, char* keys, uint32_t num_keys) {
+  void* root = get_page(pager, 0);
+  index_initialize_leaf(root);
+  set_node_root(root, true);
+  if (num_keys <= INDEX_LEAF_MAX_CELLS) {
+    memcpy(index_leaf_key(root, 0), keys, num_keys * INDEX_KEY_SIZE);
+    *leaf_node_num_cells(root) = num_keys;
+    return;
+  }
+  uint32_t num_leaves =
+      (num_keys + INDEX_LEAF_MAX_CELLS - 1) / INDEX_LEAF_MAX_CELLS;
+  if (num_leaves > INDEX_INTERNAL_MAX_CELLS + 1) {
+    printf("Index internal node is full.\n");
+    exit(EXIT_FAILURE);
+  }
+  set_node_type(root, NODE_INTERNAL);
+  *internal_node_num_keys(root) = num_leaves - 1;
+  FORLESS(num_leaves) {
+    uint32_t page_num = get_unused_page_num(pager);
+    void* leaf = get_page(pager, page_num);
+    index_initialize_leaf(leaf);
+    *node_parent(leaf) = 0;
+    uint32_t first = i * INDEX_LEAF_MAX_CELLS;
+    uint32_t count = num_keys - first < INDEX_LEAF_MAX_CELLS
+                         ? num_keys - first
+                         : INDEX_LEAF_MAX_CELLS;
+    memcpy(index_leaf_key(leaf, 0), keys + first * INDEX_KEY_SIZE,
+           count * INDEX_KEY_SIZE);
+    *leaf_node_num_cells(leaf) = count;
+    // 叶子按页号顺序分配，下一个叶子就是下一页
+    *leaf_node_next_leaf(leaf) = i + 1 < num_leaves ? page_num + 1 : 0;
+    *index_internal_child(root, i) = page_num;
+    if (i + 1 < num_leaves) {
+      memcpy(index_internal_key(root, i), index_node_max_key(leaf),
+             INDEX_KEY_SIZE);
+    }
+  }
+}
+// 建索引不阻塞写者: 先登记catch-up 缓冲再获取快照，在快照上并行扫描、排序、
+// 自底向上建树，最后在write_lock 下补上期间写入的key 并启用索引
+// 登记之后、快照之前提交的行两边都有，补写时按重复key 忽略
+ExecuteResult execute_create_index(Statement* statement, Table* table) {
+  Projection column = statement->index_column;
+  uint32_t slot = index_slot(column);
+  IndexCatchUp* catchup = &table->index_catchup[slot];
+  table_write_lock(table);
+  if (table->indexes[slot] || catchup->building) {
+    table_write_unlock(table);
+    return EXECUTE_DUPLICATE_INDEX;
+  }
+  catchup->building = true;
+  table_write_unlock(table);
+
+  ParallelScan scan;
+  scan.statement = statement;
+  scan.snapshot = table_snapshot(table);
+  scan.partitions = NULL;
+  scan.num_partitions = 0;
+  scan.capacity = 0;
+  atomic_init(&scan.next_partition, 0);
+  parallel_scan_split(&scan, scan.snapshot->root_page_num, 0, UINT32_MAX, 0);
+  uint32_t num_workers = table->scan_threads;
+  if (num_workers > scan.num_partitions) {
+    num_workers = scan.num_partitions;
+  }
+  IndexBuildWorker workers[num_workers];
+  pthread_t threads[num_workers];
+  FORLESS(num_workers) {
+    workers[i].scan = &scan;
+    workers[i].column = column;
+    workers[i].keys = NULL;
+    workers[i].num_keys = 0;
+    workers[i].capacity = 0;
+    pthread_create(&threads[i], NULL, index_build_worker, &workers[i]);
+  }
+  FORLESS(num_workers) { pthread_join(threads[i], NULL); }
+  uint32_t num_keys;
+  char* keys = index_build_merge(workers, num_workers, &num_keys);
+  FORLESS(num_workers) { free(workers[i].keys); }
+  free(scan.partitions);
+  table_release_snapshot(scan.snapshot);
+
+  char* filename = index_filename(table, column);
+  // 残留的旧索引文件可能与表不一致，重新建
+  unlink(filename);
+  Pager* pager = pager_open(filename);
+  free(filename);
+  index_bulk_load(pager, keys, num_keys);
+  free(keys);
+
+  table_write_lock(table);
+  FORLESS(catchup->num_keys) {
+    char* key = catchup->keys + i * INDEX_KEY_SIZE;
+    index_insert(pager, key, *(uint32_t*)(key + INDEX_VALUE_SIZE));
+  }
+  free(catchup->keys);
+  catchup->keys = NULL;
+  catchup->num_keys = 0;
+  catchup->capacity = 0;
+  catchup->building = false;
+  table->indexes[slot] = pager;
+  atomic_fetch_add(&table->plan_version, 1);
+  table_write_unlock(table);
+  return EXECUTE_SUCCESS;
+}
+// qsort: 候选key 按id 排序
+int index_key_compare_id(const void* a, const void* b) {
+  uint32_t a_id = *(uint32_t*)(a + INDEX_VALUE_SIZE);
+  uint32_t b_id = *(uint32_t*)(b + INDEX_VALUE_SIZE);
+  return a_id < b_id ? -1 : a_id > b_id;
+}
+// 用二级索引执行等值/前缀过滤: 在write_lock 下从索引取出候选key，再逐个回表
+// 回表读当前可见的行并重新判断条件，也过滤掉更新、删除后残留的旧key
+ExecuteResult execute_index_select(Statement* statement, Table* table) {
+  Projection column = statement->filter_column;
+  uint32_t length = statement->filter_length;
+  if (length > INDEX_VALUE_SIZE) {
+    length = INDEX_VALUE_SIZE;
+  }
+  char lo[INDEX_KEY_SIZE];
+  index_key_make(lo, statement->filter_pattern, 0);
+  uint32_t num_keys = 0;
+  uint32_t capacity = 16;
+  char* keys = malloc(capacity * INDEX_KEY_SIZE);
+
+  table_write_lock(table);
+  Pager* pager = table->indexes[index_slot(column)];
+  void* node = get_page(pager, index_find_leaf(pager, lo));
+  uint32_t cell_num = index_leaf_lower_bound(node, lo);
+  while (true) {
+    if (cell_num == *leaf_node_num_cells(node)) {
+      uint32_t next_page_num = *leaf_node_next_leaf(node);
+      if (next_page_num == 0) {
+        break;
+      }
+      node = get_page(pager, next_page_num);
+      cell_num = 0;
+      continue;
+    }
+    char* key = index_leaf_key(node, cell_num++);
+    // 等值时前缀之后必须是补的0(或值本身超过32字节)
+    if (memcmp(key, lo, length) != 0 ||
+        (statement->filter_op == FILTER_EQUAL && length < INDEX_VALUE_SIZE &&
+         key[length] != '\0')) {
+      break;
+    }
+    if (num_keys == capacity) {
+      capacity *= 2;
+      keys = realloc(keys, capacity * INDEX_KEY_SIZE);
+    }
+    memcpy(keys + num_keys * INDEX_KEY_SIZE, key, INDEX_KEY_SIZE);
+    num_keys++;
+  }
+  table_write_unlock(table);
+  // 与全表扫描一样按id 顺序输出，limit/offset 的结果也一致
+  qsort(keys, num_keys, INDEX_KEY_SIZE, index_key_compare_id);
+
+  uint32_t offset = statement->offset;
+  uint32_t limit = statement->limit;
+  uint32_t value_offset =
+      column == PROJECTION_USERNAME ? USERNAME_OFFSET : EMAIL_OFFSET;
+  for (uint32_t i = 0; i < num_keys && limit > 0 && !statement->stopped;
+       i++) {
+    char* key = keys + i * INDEX_KEY_SIZE;
+    RowView view;
+    if (!table_lookup_view(table, *(uint32_t*)(key + INDEX_VALUE_SIZE),
+                           &view)) {
+      continue;
+    }
+    // 只在行当前值对应的key 上输出，同一个id 的旧key 跳过
+    char current[INDEX_KEY_SIZE];
+    index_key_make(current, view.value + value_offset, row_view_id(&view));
+    if (index_key_compare(current, key) == 0 &&
+        filter_match(statement, view.value)) {
+      if (offset > 0) {
+        offset--;
+      } else {
+        print_row_view(&view, statement);
+        limit--;
+      }
+    }
+    row_view_release(&view);
+  }
+  free(keys);
+  return EXECUTE_SUCCESS;
+}
+// 找到的行按序列化格式拷贝到第index 个位置
+void multi_point_copy(void* arg, uint32_t index, RowView* view) {
+  memcpy((char*)arg + index * ROW_SIZE, view->value, ROW_SIZE);
+}
+// where id in (...): 列表中的id 一次交错查找，按列表顺序输出(重复的id 输出多次)
+ExecuteResult execute_multi_point_select(Statement* statement, Table* table) {
+  uint32_t* keys = malloc(statement->num_values * sizeof(uint32_t));
+  char* values = malloc(statement->num_values * ROW_SIZE);
+  uint32_t num_keys = statement_id_list(statement, keys);
+  // 先把每个位置的id 填成与key 不同的值，查完后id 等于key 的才是找到的
+  FORLESS(num_keys) {
+    *(uint32_t*)(values + i * ROW_SIZE + ID_OFFSET) = keys[i] + 1;
+  }
+  table_multi_lookup(table, keys, num_keys, multi_point_copy, values);
+  uint32_t offset = statement->offset;
+  uint32_t limit = statement->limit;
+  FORLESS(num_keys) {
+    char* value = values + i * ROW_SIZE;
+    if (*(uint32_t*)(value + ID_OFFSET) != keys[i] ||
+        !filter_match(statement, value) || limit == 0) {
+      continue;
+    }
+    if (offset > 0) {
+      offset--;
+    } else {
+      statement_emit(statement, keys[i], value + USERNAME_OFFSET,
+                     value + EMAIL_OFFSET);
+      limit--;
+    }
+  }
+  free(keys);
+  free(values);
+  return EXECUTE_SUCCESS;
+}
+// 为select 选择访问路径
+void statement_plan(Statement* statement, Table* table) {
+  statement->plan_version = atomic_load(&table->plan_version);
+  if (statement->type != STATEMENT_SELECT) {
+    return;
+  }
+  // limit/offset 是参数时不知道会不会绑定成默认值，不走并行
+  bool limited = statement->offset > 0 || statement->limit != UINT32_MAX;
+  FORLESS(statement->num_params) {
+    if (statement->params[i] == PARAM_LIMIT ||
+        statement->params[i] == PARAM_OFFSET) {
+      limited = true;
+    }
+  }
+  if (statement->num_aggregates > 0 || statement->rank) {
+    statement->plan = PLAN_COUNT;
+  } else if (statement->num_values > 0) {
+    statement->plan = PLAN_MULTI_POINT;
+  } else if (statement->select_by_id) {
+    statement->plan = PLAN_POINT;
+  } else if ((statement->filter_op == FILTER_EQUAL ||
+              statement->filter_op == FILTER_PREFIX) &&
+             table->indexes[index_slot(statement->filter_column)]) {
+    statement->plan = PLAN_INDEX;
+  } else if (table->scan_threads > 1 && !limited) {
+    statement->plan = PLAN_PARALLEL;
+  } else {
+    statement->plan = PLAN_SCAN;
+  }
+}
+ExecuteResult execute_select(Statement* statement, Table* table) {
+  switch (statement->plan) {
+  case PLAN_COUNT:
+    if (statement->rank) {
+      return execute_rank(statement, table);
+    }
+    return execute_aggregate(statement, table);
+  case PLAN_POINT: {
+    RowView view;
+    if (table_lookup_view(table, statement->id_to_select, &view)) {
+      if (filter_match(statement, view.value) && statement->offset == 0 &&
+          statement->limit > 0) {
+        print_row_view(&view, statement);
+      }
+      row_view_release(&view);
+    }
+    return EXECUTE_SUCCESS;
+  }
+  case PLAN_MULTI_POINT:
+    return execute_multi_point_select(statement, table);
+  case PLAN_INDEX:
+    return execute_index_select(statement, table);
+  case PLAN_PARALLEL:
+    return execute_parallel_select(statement, table);
+  case PLAN_SCAN:
+    break;
+  }
+  return execute_range_select(statement, table, 0, UINT32_MAX);
+}
+// 扫描key 在[lo, hi] 内的行
+ExecuteResult execute_range_select(Statement* statement, Table* table,
+                                   uint32_t lo, uint32_t hi) {
+  uint32_t offset = statement->offset;
+  uint32_t limit = statement->limit;
+  // 全表扫描在读视图下逐个叶子处理: pin 住叶子后一次取出整个叶子的batch
+  // 被pin 的叶子写者会复制后再改，扫描不需要拷贝行，也不阻塞写者
+  ReadView view;
+  // lo 是下一个要输出的key，重新定位时从这里开始
+  if (offset > 0 && lo == 0 && statement->filter_op == FILTER_NONE) {
+    // 在write_lock 下打开读视图，此时的子树计数正好是读视图看到的行
+    // 直接定位到第offset 行开始扫描; 有过滤条件时只能逐行跳过
+    table_write_lock(table);
+    read_view_open(table, &view);
+    bool found = table_nth_key(table, offset, &lo);
+    table_write_unlock(table);
+    if (!found) {
+      read_view_close(table, &view);
+      return EXECUTE_SUCCESS;
+    }
+    offset = 0;
+  } else {
+    read_view_open(table, &view);
+  }
+  uint32_t phase = pager_read_enter(table->pager);
+  RowBatch batch;
+  uint32_t leaves = 0;
+  uint32_t skipped_leaves = 0;
+  Cursor* cursor = table_find(table, lo);
+  while (limit > 0 && !statement->stopped) {
+    void* node = pager_pin(table->pager, cursor->page_num, cursor->version);
+    if (node == NULL) {
+      free(cursor);
+      cursor = table_find(table, lo);
+      continue;
+    }
+    leaves++;
+    batch.num_rows = 0;
+    bool finished = false;
+    if (leaf_node_zone_may_match(node, statement)) {
+      finished = row_batch_fill(&batch, node, cursor->cell_num, view.txn_id,
+                                lo, hi, statement);
+    } else {
+      skipped_leaves++;
+    }
+    // 重新定位从batch 最后一行之后开始，被offset/limit 去掉的行也算已处理
+    uint32_t num_rows = batch.num_rows;
+    uint32_t last_id = num_rows > 0 ? batch.ids[num_rows - 1] : 0;
+    row_batch_limit(&batch, &offset, &limit);
+    row_batch_print(&batch, statement);
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    pager_unpin(node);
+    if (finished) {
+      break;
+    }
+    if (num_rows > 0) {
+      if (last_id >= hi) {
+        break;
+      }
+      lo = last_id + 1;
+    }
+    if (next_page_num == 0) {
+      break;
+    }
+    cursor->page_num = next_page_num;
+    cursor->cell_num = 0;
+    cursor->version = node_read_begin(table->pager, next_page_num);
+  }
+  free(cursor);
+  pager_read_exit(table->pager, phase);
+  read_view_close(table, &view);
+  atomic_store(&table->scan_leaves, leaves);
+  atomic_store(&table->scan_skipped_leaves, skipped_leaves);
+
+  return EXECUTE_SUCCESS;
+}
+ExecuteResult execute_statement(Statement* statement, Table* table) {
+  switch (statement->type) {
+  case STATEMENT_INSERT:
+    return execute_insert(statement, table);
+  case STATEMENT_SELECT:
+    return execute_select(statement, table);
+  case STATEMENT_UPDATE:
+    return execute_update(statement, table);
+  case STATEMENT_UPSERT:
+    return execute_upsert(statement, table);
+  case STATEMENT_DELETE:
+    return execute_delete(statement, table);
+  case STATEMENT_CREATE_INDEX:
+    return execute_create_index(statement, table);
+  }
+}
+// 词法分析: token 是输入中的片段，不复制也不修改输入
+typedef struct {
+  const char* start;
+  uint32_t length;
+} Token;
+typedef struct {
+  const char* next;
+  const char* end;
+  // select 的列之间可以用逗号分隔
+  bool comma;
+} Lexer;
+
+void lexer_init(Lexer* lexer, const char* input, uint32_t length) {
+  lexer->next = input;
+  lexer->end = input + length;
+  lexer->comma = false;
+}
+bool lexer_is_separator(Lexer* lexer, char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+         (lexer->comma && c == ',');
+}
+// 取下一个token，输入结束时返回false
+bool lexer_next(Lexer* lexer, Token* token) {
+  const char* p = lexer->next;
+  while (p < lexer->end && lexer_is_separator(lexer, *p)) {
+    p++;
+  }
+  token->start = p;
+  while (p < lexer->end && !lexer_is_separator(lexer, *p)) {
+    p++;
+  }
+  token->length = p - token->start;
+  lexer->next = p;
+  return token->length > 0;
+}
+bool token_is(Token* token, const char* word) {
+  return token->length == strlen(word) &&
+         memcmp(token->start, word, token->length) == 0;
+}
+// 十进制非负整数: 负数返回PREPARE_NEGATIVE_ID，含其他字符或超过UINT32_MAX 是语法错误
+PrepareResult token_to_uint32(Token* token, uint32_t* value) {
+  const char* p = token->start;
+  const char* end = p + token->length;
+  bool negative = p < end && *p == '-';
+  if (negative) {
+    p++;
+  }
+  if (p == end) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  uint64_t result = 0;
+  for (; p < end; p++) {
+    if (*p < '0' || *p > '9') {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    result = result * 10 + (*p - '0');
+    if (result > UINT32_MAX) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+  }
+  if (negative) {
+    return PREPARE_NEGATIVE_ID;
+  }
+  *value = result;
+  return PREPARE_SUCCESS;
+}
+// 把token 复制成以'\0' 结尾的列值
+PrepareResult token_copy(Token* token, char* dest, uint32_t max_length) {
+  if (token->length > max_length) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+  memcpy(dest, token->start, token->length);
+  dest[token->length] = '\0';
+  return PREPARE_SUCCESS;
+}
+// ? 占位符: 记录参数对应的字段，值在执行前绑定
+bool statement_add_param(Statement* statement, Token* token, ParamSlot slot) {
+  if (!token_is(token, "?")) {
+    return false;
+  }
+  statement->params[statement->num_params++] = slot;
+  return true;
+}
+// id 或? 参数
+PrepareResult prepare_id(Statement* statement, Token* token, ParamSlot slot,
+                         uint32_t* id) {
+  if (statement_add_param(statement, token, slot)) {
+    return PREPARE_SUCCESS;
+  }
+  return token_to_uint32(token, id);
+}
+// 跳过分隔符，下一个字符是c 时吃掉它
+bool lexer_skip(Lexer* lexer, char c) {
+  while (lexer->next < lexer->end && lexer_is_separator(lexer, *lexer->next)) {
+    lexer->next++;
+  }
+  if (lexer->next < lexer->end && *lexer->next == c) {
+    lexer->next++;
+    return true;
+  }
+  return false;
+}
+// values 中的一行: (id, username, email)，不支持? 参数
+PrepareResult prepare_values_row(Lexer* lexer, Row* row) {
+  if (!lexer_skip(lexer, '(')) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  const char* close = memchr(lexer->next, ')', lexer->end - lexer->next);
+  if (close == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  Lexer fields;
+  lexer_init(&fields, lexer->next, close - lexer->next);
+  fields.comma = true;
+  lexer->next = close + 1;
+  Token id, username, email, rest;
+  if (!lexer_next(&fields, &id) || !lexer_next(&fields, &username) ||
+      !lexer_next(&fields, &email) || lexer_next(&fields, &rest)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  PrepareResult result = token_to_uint32(&id, &row->id);
+  if (result == PREPARE_SUCCESS) {
+    result = token_copy(&username, row->username, COLUMN_USERNAME);
+  }
+  if (result == PREPARE_SUCCESS) {
+    result = token_copy(&email, row->email, COLUMN_EMAIL);
+  }
+  return result;
+}
+// insert values (...), (...): 这里只检查语法和计数
+PrepareResult prepare_insert_values(Lexer* lexer, Statement* statement) {
+  statement->values = lexer->next;
+  statement->values_length = lexer->end - lexer->next;
+  Row row;
+  do {
+    PrepareResult result = prepare_values_row(lexer, &row);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+    statement->num_values++;
+  } while (lexer_skip(lexer, ','));
+  Token rest;
+  if (lexer_next(lexer, &rest)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  statement->type = STATEMENT_INSERT;
+  return PREPARE_SUCCESS;
+}
+// 执行时把values 解析到rows，prepare 时已经检查过
+void statement_values(Statement* statement, Row* rows) {
+  Lexer lexer;
+  lexer_init(&lexer, statement->values, statement->values_length);
+  FORLESS(statement->num_values) {
+    prepare_values_row(&lexer, &rows[i]);
+    lexer_skip(&lexer, ',');
+  }
+}
+// insert [or replace] id username email 或insert values (...), (...)
+PrepareResult prepare_insert(Lexer* lexer, Statement* statement) {
+  Token id, username, email, rest;
+  if (!lexer_next(lexer, &id)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  StatementType type = STATEMENT_INSERT;
+  if (token_is(&id, "or")) {
+    Token replace;
+    if (!lexer_next(lexer, &replace) || !token_is(&replace, "replace") ||
+        !lexer_next(lexer, &id) || token_is(&id, "values")) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    type = STATEMENT_UPSERT;
+  }
+  if (token_is(&id, "values")) {
+    return prepare_insert_values(lexer, statement);
+  }
+  if (!lexer_next(lexer, &username) || !lexer_next(lexer, &email) ||
+      lexer_next(lexer, &rest)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  Row* row = &statement->row_to_insert;
+  PrepareResult result =
+      prepare_id(statement, &id, PARAM_ROW_ID, &row->id);
+  if (result != PREPARE_SUCCESS) {
+    return result;
+  }
+  if (!statement_add_param(statement, &username, PARAM_USERNAME)) {
+    result = token_copy(&username, row->username, COLUMN_USERNAME);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+  }
+  if (!statement_add_param(statement, &email, PARAM_EMAIL)) {
+    result = token_copy(&email, row->email, COLUMN_EMAIL);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+  }
+  statement->type = type;
+  return PREPARE_SUCCESS;
+}
+PrepareResult prepare_update_set(Lexer* lexer, Statement* statement);
+// update 与insert 格式相同: update id username email，或update set ...
+PrepareResult prepare_update(Lexer* lexer, Statement* statement) {
+  Lexer peek = *lexer;
+  Token first;
+  if (lexer_next(&peek, &first) && token_is(&first, "set")) {
+    return prepare_update_set(&peek, statement);
+  }
+  // 整行更新不支持values 和or replace
+  if (token_is(&first, "values") || token_is(&first, "or")) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  PrepareResult result = prepare_insert(lexer, statement);
+  statement->type = STATEMENT_UPDATE;
+  return result;
+}
+// delete id
+PrepareResult prepare_delete(Lexer* lexer, Statement* statement) {
+  Token id, rest;
+  if (!lexer_next(lexer, &id) || lexer_next(lexer, &rest)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  statement->type = STATEMENT_DELETE;
+  return prepare_id(statement, &id, PARAM_ROW_ID,
+                    &statement->row_to_insert.id);
+}
+// where id in (1, 2, ...): 这里只检查语法和计数，不支持? 参数
+PrepareResult prepare_id_list(Lexer* lexer, Statement* statement) {
+  if (!lexer_skip(lexer, '(')) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  const char* close = memchr(lexer->next, ')', lexer->end - lexer->next);
+  if (close == NULL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  statement->values = lexer->next;
+  statement->values_length = close - lexer->next;
+  lexer->next = close + 1;
+  Lexer ids;
+  lexer_init(&ids, statement->values, statement->values_length);
+  ids.comma = true;
+  Token id;
+  uint32_t key;
+  while (lexer_next(&ids, &id)) {
+    PrepareResult result = token_to_uint32(&id, &key);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+    statement->num_values++;
+  }
+  return statement->num_values > 0 ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+// 执行时把id 列表解析到keys，返回写入的个数(准备时已检查过，等于num_values)
+uint32_t statement_id_list(Statement* statement, uint32_t* keys) {
+  Lexer ids;
+  lexer_init(&ids, statement->values, statement->values_length);
+  ids.comma = true;
+  Token id;
+  uint32_t num_keys = 0;
+  while (num_keys < statement->num_values && lexer_next(&ids, &id) &&
+         token_to_uint32(&id, &keys[num_keys]) == PREPARE_SUCCESS) {
+    num_keys++;
+  }
+  return num_keys;
+}
+// 聚合名 -> Aggregate，不是聚合返回false
+bool parse_aggregate(Token* name, Aggregate* aggregate) {
+  if (token_is(name, "count(*)")) {
+    *aggregate = AGGREGATE_COUNT;
+  } else if (token_is(name, "min(id)")) {
+    *aggregate = AGGREGATE_MIN;
+  } else if (token_is(name, "max(id)")) {
+    *aggregate = AGGREGATE_MAX;
+  } else {
+    return false;
+  }
+  return true;
+}
+// 列名 -> Projection，不是列名返回0
+Projection parse_column(Token* name) {
+  if (token_is(name, "id")) {
+    return PROJECTION_ID;
+  }
+  if (token_is(name, "username")) {
+    return PROJECTION_USERNAME;
+  }
+  if (token_is(name, "email")) {
+    return PROJECTION_EMAIL;
+  }
+  return 0;
+}
+// set 的值: ? 参数，或去掉引号后复制到row
+PrepareResult prepare_set_value(Statement* statement, Projection column,
+                                Token* value) {
+  Row* row = &statement->row_to_insert;
+  if (column == PROJECTION_USERNAME) {
+    if (statement_add_param(statement, value, PARAM_USERNAME)) {
+      return PREPARE_SUCCESS;
+    }
+  } else if (statement_add_param(statement, value, PARAM_EMAIL)) {
+    return PREPARE_SUCCESS;
+  }
+  Token text = *value;
+  if (text.length >= 2 && text.start[0] == '\'' &&
+      text.start[text.length - 1] == '\'') {
+    text.start++;
+    text.length -= 2;
+  }
+  if (column == PROJECTION_USERNAME) {
+    return token_copy(&text, row->username, COLUMN_USERNAME);
+  }
+  return token_copy(&text, row->email, COLUMN_EMAIL);
+}
+// update set username = x, email = y where id = z: 只改列出的列，值和id 都可以是?
+PrepareResult prepare_update_set(Lexer* lexer, Statement* statement) {
+  lexer->comma = true;
+  statement->type = STATEMENT_UPDATE;
+  statement->update_columns = 0;
+  Token column, op, value;
+  while (lexer_next(lexer, &column) && !token_is(&column, "where")) {
+    Projection target = parse_column(&column);
+    if ((target != PROJECTION_USERNAME && target != PROJECTION_EMAIL) ||
+        (statement->update_columns & target) || !lexer_next(lexer, &op) ||
+        !token_is(&op, "=") || !lexer_next(lexer, &value)) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    statement->update_columns |= target;
+    PrepareResult result = prepare_set_value(statement, target, &value);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+  }
+  Token id_column, id, rest;
+  if (statement->update_columns == 0 || !token_is(&column, "where") ||
+      !lexer_next(lexer, &id_column) || !token_is(&id_column, "id") ||
+      !lexer_next(lexer, &op) || !token_is(&op, "=") ||
+      !lexer_next(lexer, &id) || lexer_next(lexer, &rest)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  return prepare_id(statement, &id, PARAM_ROW_ID,
+                    &statement->row_to_insert.id);
+}
+// 由过滤条件推出zone map 的检查范围，推不出时不跳过叶子
+void prepare_zone_probe(Statement* statement) {
+  char* pattern = statement->filter_pattern;
+  uint32_t len = statement->filter_length;
+  FilterOp op = statement->filter_op;
+  if (statement->filter_column == PROJECTION_USERNAME &&
+      (op == FILTER_EQUAL || op == FILTER_PREFIX)) {
+    // 匹配的username 前8字节落在[pattern 补0, pattern 补0xFF] 内
+    // 相等或pattern 不短于8字节时两端相同
+    statement->zone_by_username = true;
+    prefix_copy(statement->zone_lo, pattern, LEAF_NODE_ZONE_PREFIX_SIZE);
+    memcpy(statement->zone_hi, statement->zone_lo, LEAF_NODE_ZONE_PREFIX_SIZE);
+    if (op == FILTER_PREFIX && len < LEAF_NODE_ZONE_PREFIX_SIZE) {
+      memset(statement->zone_hi + len, 0xFF, LEAF_NODE_ZONE_PREFIX_SIZE - len);
+    }
+  }
+  if (statement->filter_column == PROJECTION_EMAIL &&
+      (op == FILTER_EQUAL || op == FILTER_SUFFIX)) {
+    // 匹配的email 最后一个'@' 就是pattern 的最后一个'@'
+    statement->zone_bloom = zone_domain_bits(pattern, len);
+  }
+}
+// 设置过滤条件，pattern 不带引号; like 时由首尾的% 决定FilterOp
+PrepareResult statement_set_filter(Statement* statement, Projection column,
+                                   bool like, const char* pattern,
+                                   uint32_t len) {
+  statement->filter_column = column;
+  statement->filter_like = like;
+  statement->filter_op = FILTER_EQUAL;
+  if (like) {
+    bool leading = len > 0 && pattern[0] == '%';
+    if (leading) {
+      pattern++;
+      len--;
+    }
+    bool trailing = len > 0 && pattern[len - 1] == '%';
+    if (trailing) {
+      len--;
+    }
+    if (leading) {
+      statement->filter_op = trailing ? FILTER_CONTAINS : FILTER_SUFFIX;
+    } else if (trailing) {
+      statement->filter_op = FILTER_PREFIX;
+    }
+    // 只支持首尾的%
+    if (memchr(pattern, '%', len)) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+  }
+  if (len > COLUMN_EMAIL) {
+    return PREPARE_STRING_TOO_LONG;
+  }
+  memcpy(statement->filter_pattern, pattern, len);
+  statement->filter_pattern[len] = '\0';
+  statement->filter_length = len;
+  statement->zone_by_username = false;
+  statement->zone_bloom = 0;
+  prepare_zone_probe(statement);
+  return PREPARE_SUCCESS;
+}
+// where username/email = 'x' 或like 'x%' / '%x' / '%x%'，值也可以是?
+PrepareResult prepare_filter(Statement* statement, Projection column,
+                             Token* op, Token* pattern) {
+  bool like = token_is(op, "like");
+  if (!like && !token_is(op, "=")) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  if (statement_add_param(statement, pattern, PARAM_FILTER)) {
+    // like ? 绑定前不知道能否走索引，先按包含处理
+    statement->filter_column = column;
+    statement->filter_like = like;
+    statement->filter_op = like ? FILTER_CONTAINS : FILTER_EQUAL;
+    statement->filter_pattern[0] = '\0';
+    statement->filter_length = 0;
+    return PREPARE_SUCCESS;
+  }
+  const char* start = pattern->start;
+  uint32_t len = pattern->length;
+  // 去掉引号
+  if (len >= 2 && start[0] == '\'' && start[len - 1] == '\'') {
+    start++;
+    len -= 2;
+  }
+  return statement_set_filter(statement, column, like, start, len);
+}
+// select [*|列, ...] [where id = x | where 列 =/like '...'] [unordered]
+// select count(*)|min(id)|max(id), ...
+// select ... [limit n] [offset m]，select rank where id = x
+// 不带任何子句的select，还没有选择列
+void statement_init_select(Statement* statement) {
+  statement->type = STATEMENT_SELECT;
+  statement->select_by_id = false;
+  statement->unordered = false;
+  statement->num_columns = 0;
+  statement->projection = 0;
+  statement->num_aggregates = 0;
+  statement->rank = false;
+  statement->limit = UINT32_MAX;
+  statement->offset = 0;
+  statement->filter_op = FILTER_NONE;
+  statement->zone_by_username = false;
+  statement->zone_bloom = 0;
+}
+void statement_select_all_columns(Statement* statement) {
+  statement->columns[0] = PROJECTION_ID;
+  statement->columns[1] = PROJECTION_USERNAME;
+  statement->columns[2] = PROJECTION_EMAIL;
+  statement->num_columns = 3;
+  statement->projection =
+      PROJECTION_ID | PROJECTION_USERNAME | PROJECTION_EMAIL;
+}
+// limit/offset 的值: 非负整数或?
+PrepareResult prepare_count(Statement* statement, Lexer* lexer, ParamSlot slot,
+                            uint32_t* count) {
+  Token token;
+  if (!lexer_next(lexer, &token)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  PrepareResult result = prepare_id(statement, &token, slot, count);
+  return result == PREPARE_NEGATIVE_ID ? PREPARE_SYNTAX_ERROR : result;
+}
+PrepareResult prepare_select(Lexer* lexer, Statement* statement) {
+  statement_init_select(statement);
+  lexer->comma = true;
+
+  Token word;
+  bool more = lexer_next(lexer, &word);
+  Aggregate aggregate;
+  if (more && token_is(&word, "*")) {
+    more = lexer_next(lexer, &word);
+  } else if (more && token_is(&word, "rank")) {
+    // 只支持select rank where id = x
+    statement->rank = true;
+    Token where, column, op, id, rest;
+    if (!lexer_next(lexer, &where) || !lexer_next(lexer, &column) ||
+        !lexer_next(lexer, &op) || !lexer_next(lexer, &id) ||
+        !token_is(&where, "where") || !token_is(&column, "id") ||
+        !token_is(&op, "=") || lexer_next(lexer, &rest)) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    return prepare_id(statement, &id, PARAM_SELECT_ID,
+                      &statement->id_to_select);
+  } else if (more && parse_aggregate(&word, &aggregate)) {
+    // 聚合不支持where 等其他子句
+    while (more) {
+      if (!parse_aggregate(&word, &aggregate) ||
+          statement->num_aggregates == 3) {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      statement->aggregates[statement->num_aggregates++] = aggregate;
+      more = lexer_next(lexer, &word);
+    }
+    return PREPARE_SUCCESS;
+  } else {
+    Projection column;
+    while (more && (column = parse_column(&word))) {
+      // 同一列只能出现一次
+      if (statement->projection & column) {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      statement->columns[statement->num_columns++] = column;
+      statement->projection |= column;
+      more = lexer_next(lexer, &word);
+    }
+  }
+  if (statement->num_columns == 0) {
+    statement_select_all_columns(statement);
+  }
+  PrepareResult result;
+  if (more && token_is(&word, "where")) {
+    Token columnToken, op, value;
+    if (!lexer_next(lexer, &columnToken) || !lexer_next(lexer, &op)) {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    Projection column = parse_column(&columnToken);
+    if (column == PROJECTION_ID && token_is(&op, "in")) {
+      result = prepare_id_list(lexer, statement);
+    } else if (!lexer_next(lexer, &value)) {
+      return PREPARE_SYNTAX_ERROR;
+    } else if (column == PROJECTION_ID) {
+      if (!token_is(&op, "=")) {
+        return PREPARE_SYNTAX_ERROR;
+      }
+      statement->select_by_id = true;
+      result = prepare_id(statement, &value, PARAM_SELECT_ID,
+                          &statement->id_to_select);
+    } else if (column) {
+      result = prepare_filter(statement, column, &op, &value);
+    } else {
+      return PREPARE_SYNTAX_ERROR;
+    }
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+    more = lexer_next(lexer, &word);
+  }
+  if (more && token_is(&word, "unordered")) {
+    statement->unordered = true;
+    more = lexer_next(lexer, &word);
+  }
+  if (more && token_is(&word, "limit")) {
+    result = prepare_count(statement, lexer, PARAM_LIMIT, &statement->limit);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+    more = lexer_next(lexer, &word);
+  }
+  if (more && token_is(&word, "offset")) {
+    result = prepare_count(statement, lexer, PARAM_OFFSET, &statement->offset);
+    if (result != PREPARE_SUCCESS) {
+      return result;
+    }
+    more = lexer_next(lexer, &word);
+  }
+  if (more) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  return PREPARE_SUCCESS;
+}
+// create index on username/email
+PrepareResult prepare_create_index(Lexer* lexer, Statement* statement) {
+  Token index, on, columnToken, rest;
+  if (!lexer_next(lexer, &index) || !lexer_next(lexer, &on) ||
+      !lexer_next(lexer, &columnToken) || !token_is(&index, "index") ||
+      !token_is(&on, "on") || lexer_next(lexer, &rest)) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  Projection column = parse_column(&columnToken);
+  if (column != PROJECTION_USERNAME && column != PROJECTION_EMAIL) {
+    return PREPARE_SYNTAX_ERROR;
+  }
+  statement->type = STATEMENT_CREATE_INDEX;
+  statement->index_column = column;
+  return PREPARE_SUCCESS;
+}
+// SQL 文本 -> Statement 入口，不修改输入也不分配内存
+PrepareResult prepare_statement(const char* sql, uint32_t length,
+                                Statement* statement) {
+  statement->num_params = 0;
+  statement->bound = 0;
+  statement->num_values = 0;
+  statement->update_columns = PROJECTION_USERNAME | PROJECTION_EMAIL;
+  statement->plan = PLAN_SCAN;
+  Lexer lexer;
+  lexer_init(&lexer, sql, length);
+  Token keyword;
+  if (!lexer_next(&lexer, &keyword)) {
+    return PREPARE_UNRECOGNIZED_STATEMENT;
+  }
+  if (token_is(&keyword, "insert")) {
+    return prepare_insert(&lexer, statement);
+  }
+  if (token_is(&keyword, "update")) {
+    return prepare_update(&lexer, statement);
+  }
+  if (token_is(&keyword, "delete")) {
+    return prepare_delete(&lexer, statement);
+  }
+  if (token_is(&keyword, "select")) {
+    return prepare_select(&lexer, statement);
+  }
+  if (token_is(&keyword, "create")) {
+    return prepare_create_index(&lexer, statement);
+  }
+  return PREPARE_UNRECOGNIZED_STATEMENT;
+}
+// db.h 接口
+DBResult db_result_from_execute(ExecuteResult result) {
+  switch (result) {
+  case EXECUTE_SUCCESS:
+    return DB_OK;
+  case EXECUTE_DUPLICATE_KEY:
+    return DB_DUPLICATE_KEY;
+  case EXECUTE_NOT_FOUND:
+    return DB_NOT_FOUND;
+  case EXECUTE_DUPLICATE_INDEX:
+    return DB_DUPLICATE_INDEX;
+  case EXECUTE_FULL_TABLE:
+    return DB_FULL_TABLE;
+  }
+  return DB_OK;
+}
+DBResult db_result_from_prepare(PrepareResult result) {
+  switch (result) {
+  case PREPARE_SUCCESS:
+    return DB_OK;
+  case PREPARE_SYNTAX_ERROR:
+    return DB_SYNTAX_ERROR;
+  case PREPARE_STRING_TOO_LONG:
+    return DB_STRING_TOO_LONG;
+  case PREPARE_NEGATIVE_ID:
+    return DB_NEGATIVE_ID;
+  case PREPARE_UNRECOGNIZED_STATEMENT:
+    return DB_UNRECOGNIZED_STATEMENT;
+  }
+  return DB_OK;
+}
+// 单行接口直接走table_insert/table_lookup，不经过解析
+DBResult db_write(DB* db, uint32_t id, const char* username,
+                  const char* email, WriteMode mode) {
+  size_t username_length = strnlen(username, COLUMN_USERNAME + 1);
+  size_t email_length = strnlen(email, COLUMN_EMAIL + 1);
+  if (username_length > COLUMN_USERNAME || email_length > COLUMN_EMAIL) {
+    return DB_STRING_TOO_LONG;
+  }
+  Row row;
+  row.id = id;
+  memcpy(row.username, username, username_length + 1);
+  memcpy(row.email, email, email_length + 1);
+  return db_result_from_execute(table_write_row(
+      db, &row, PROJECTION_USERNAME | PROJECTION_EMAIL, mode));
+}
+DBResult db_put(DB* db, uint32_t id, const char* username, const char* email) {
+  return db_write(db, id, username, email, WRITE_INSERT);
+}
+DBResult db_upsert(DB* db, uint32_t id, const char* username,
+                   const char* email) {
+  return db_write(db, id, username, email, WRITE_UPSERT);
+}
+DBResult db_put_batch(DB* db, const DBRow* rows, uint32_t num_rows,
+                      DBResult* results) {
+  ExecuteResult* row_results =
+      results ? malloc(num_rows * sizeof(ExecuteResult)) : NULL;
+  ExecuteResult result =
+      table_insert_batch(db, (Row*)rows, num_rows, row_results, NULL);
+  if (results) {
+    FORLESS(num_rows) { results[i] = db_result_from_execute(row_results[i]); }
+    free(row_results);
+  }
+  return db_result_from_execute(result);
+}
+bool db_get(DB* db, uint32_t id, DBRow* row) {
+  return table_lookup(db, id, row);
+}
+typedef struct {
+  DBRow* rows;
+  bool* found;
+  uint32_t num_found;
+} MultiGet;
+void multi_get_visit(void* arg, uint32_t index, RowView* view) {
+  MultiGet* multi_get = arg;
+  deserialize_row(&multi_get->rows[index], view->value);
+  if (multi_get->found) {
+    multi_get->found[index] = true;
+  }
+  multi_get->num_found++;
+}
+uint32_t db_multi_get(DB* db, const uint32_t* ids, uint32_t num_ids,
+                      DBRow* rows, bool* found) {
+  MultiGet multi_get = {rows, found, 0};
+  if (found) {
+    memset(found, 0, num_ids * sizeof(bool));
+  }
+  table_multi_lookup(db, ids, num_ids, multi_get_visit, &multi_get);
+  return multi_get.num_found;
+}
+void db_stats(DB* db, DBStats* stats) {
+  Pager* pager = db->pager;
+  pthread_mutex_lock(&pager->load_lock);
+  stats->pages_read = pager->pages_read;
+  stats->num_pages = pager->num_pages;
+  stats->pages_cached = 0;
+  FORLESS(pager->num_pages) {
+    if (pager->pages[i] != NULL) {
+      stats->pages_cached++;
+    }
+  }
+  pthread_mutex_unlock(&pager->load_lock);
+  stats->scan_leaves = atomic_load(&db->scan_leaves);
+  stats->scan_skipped_leaves = atomic_load(&db->scan_skipped_leaves);
+  pthread_mutex_lock(&db->plan_cache->lock);
+  stats->plan_cache_hits = db->plan_cache->hits;
+  stats->plan_cache_misses = db->plan_cache->misses;
+  pthread_mutex_unlock(&db->plan_cache->lock);
+}
+void db_set_threads(DB* db, uint32_t threads) {
+  atomic_store(&db->scan_threads, threads > 1 ? threads : 1);
+  atomic_fetch_add(&db->plan_version, 1);
+}
+DBResult db_delete(DB* db, uint32_t id) {
+  return db_result_from_execute(table_delete(db, id));
+}
+void db_scan(DB* db, uint32_t lo, uint32_t hi, DBRowCallback callback,
+             void* arg) {
+  Statement statement;
+  statement_init_select(&statement);
+  statement_select_all_columns(&statement);
+  statement.callback = callback;
+  statement.callback_arg = arg;
+  statement.stopped = false;
+  if (lo <= hi) {
+    execute_range_select(&statement, db, lo, hi);
+  }
+}
+// FNV-1a，同时得到文本长度
+uint32_t plan_cache_slot(const char* sql, uint32_t* length) {
+  uint32_t hash = 2166136261u;
+  const char* p = sql;
+  for (; *p; p++) {
+    hash = (hash ^ (uint8_t)*p) * 16777619u;
+  }
+  *length = p - sql;
+  return hash % PLAN_CACHE_SIZE;
+}
+// 相同文本直接复制缓存的Statement，跳过解析和选择访问路径
+DBResult statement_prepare(DB* db, const char* sql, Statement* statement) {
+  PlanCache* cache = db->plan_cache;
+  uint32_t length;
+  uint32_t slot = plan_cache_slot(sql, &length);
+  pthread_mutex_lock(&cache->lock);
+  if (length > 0 && strcmp(cache->sql[slot], sql) == 0) {
+    *statement = cache->statements[slot];
+    cache->hits++;
+    pthread_mutex_unlock(&cache->lock);
+    return DB_OK;
+  }
+  cache->misses++;
+  pthread_mutex_unlock(&cache->lock);
+
+  PrepareResult result = prepare_statement(sql, length, statement);
+  if (result != PREPARE_SUCCESS) {
+    return db_result_from_prepare(result);
+  }
+  statement_plan(statement, db);
+  // 带字面值的写语句几乎不会原样重复，不缓存，免得挤掉其他语句
+  // values/id 列表指向调用者的sql，也不缓存
+  if ((statement->type == STATEMENT_SELECT || statement->num_params > 0) &&
+      statement->num_values == 0 && length < PLAN_CACHE_SQL_SIZE) {
+    pthread_mutex_lock(&cache->lock);
+    memcpy(cache->sql[slot], sql, length + 1);
+    cache->statements[slot] = *statement;
+    pthread_mutex_unlock(&cache->lock);
+  }
+  return DB_OK;
+}
+DBResult db_prepare(DB* db, const char* sql, DBStatement** statement) {
+  *statement = malloc(sizeof(Statement));
+  DBResult result = statement_prepare(db, sql, *statement);
+  if (result != DB_OK) {
+    free(*statement);
+    *statement = NULL;
+  } else if ((*statement)->num_values > 0) {
+    // values 的文本跟着Statement 保存，执行时sql 可能已经释放
+    Statement* copy =
+        realloc(*statement, sizeof(Statement) + (*statement)->values_length);
+    memcpy(copy + 1, copy->values, copy->values_length);
+    copy->values = (const char*)(copy + 1);
+    *statement = copy;
+  }
+  return result;
+}
+// 参数从1开始编号
+DBResult db_bind_int(DBStatement* statement, uint32_t index, uint32_t value) {
+  if (index == 0 || index > statement->num_params) {
+    return DB_PARAMETER_ERROR;
+  }
+  switch (statement->params[index - 1]) {
+  case PARAM_ROW_ID:
+    statement->row_to_insert.id = value;
+    break;
+  case PARAM_SELECT_ID:
+    statement->id_to_select = value;
+    break;
+  case PARAM_LIMIT:
+    statement->limit = value;
+    break;
+  case PARAM_OFFSET:
+    statement->offset = value;
+    break;
+  default:
+    return DB_PARAMETER_ERROR;
+  }
+  statement->bound |= 1 << (index - 1);
+  return DB_OK;
+}
+DBResult db_bind_text(DBStatement* statement, uint32_t index,
+                      const char* value) {
+  if (index == 0 || index > statement->num_params) {
+    return DB_PARAMETER_ERROR;
+  }
+  size_t length = strlen(value);
+  switch (statement->params[index - 1]) {
+  case PARAM_USERNAME:
+    if (length > COLUMN_USERNAME) {
+      return DB_STRING_TOO_LONG;
+    }
+    memcpy(statement->row_to_insert.username, value, length + 1);
+    break;
+  case PARAM_EMAIL:
+    if (length > COLUMN_EMAIL) {
+      return DB_STRING_TOO_LONG;
+    }
+    memcpy(statement->row_to_insert.email, value, length + 1);
+    break;
+  case PARAM_FILTER: {
+    PrepareResult result =
+        statement_set_filter(statement, statement->filter_column,
+                             statement->filter_like, value, length);
+    if (result != PREPARE_SUCCESS) {
+      return db_result_from_prepare(result);
+    }
+    // like 的值决定了能否走索引，执行前重新选择访问路径
+    if (statement->filter_like) {
+      statement->plan_version = 0;
+    }
+    break;
+  }
+  default:
+    return DB_PARAMETER_ERROR;
+  }
+  statement->bound |= 1 << (index - 1);
+  return DB_OK;
+}
+DBResult db_execute(DB* db, DBStatement* statement, DBRowCallback callback,
+                    void* arg) {
+  if (statement->bound != (1u << statement->num_params) - 1) {
+    return DB_PARAMETER_ERROR;
+  }
+  if (statement->plan_version != atomic_load(&db->plan_version)) {
+    statement_plan(statement, db);
+  }
+  statement->callback = callback;
+  statement->callback_arg = arg;
+  statement->stopped = false;
+  return db_result_from_execute(execute_statement(statement, db));
+}
+void db_finalize(DBStatement* statement) { free(statement); }
+void db_begin(DB* db) {
+  if (table_owns_transaction(db)) {
+    return;
+  }
+  pthread_mutex_lock(&db->write_lock);
+  db->write_txn_id = db->next_txn_id++;
+  db->txn_owner = pthread_self();
+  atomic_store(&db->in_transaction, true);
+}
+void db_commit(DB* db) {
+  if (!table_owns_transaction(db)) {
+    return;
+  }
+  atomic_store(&db->in_transaction, false);
+  atomic_store(&db->committed_txn_id, db->write_txn_id);
+  pthread_mutex_unlock(&db->write_lock);
+}
+// 只执行一次的语句放在栈上，不分配内存
+DBResult db_exec(DB* db, const char* sql, DBRowCallback callback, void* arg) {
+  Statement statement;
+  DBResult result = statement_prepare(db, sql, &statement);
+  if (result != DB_OK) {
+    return result;
+  }
+  return db_execute(db, &statement, callback, arg);
+}
+#ifndef DB_LIBRARY
+// 语句执行结果，acknowledge 为false 时成功不打印Executed.
+void print_result(DBResult result, const char* input, bool acknowledge) {
+  switch (result) {
+  case DB_OK:
+    if (acknowledge) {
+      printf("Executed.\n");
+    }
+    break;
+  case DB_NEGATIVE_ID:
+    printf("input ID is negative: %s.\n", input);
+    break;
+  case DB_SYNTAX_ERROR:
+    printf("input syntax is error: %s.\n", input);
+    break;
+  case DB_STRING_TOO_LONG:
+    printf("input variable is too long: %s.\n", input);
+    break;
+  case DB_UNRECOGNIZED_STATEMENT:
+    printf("input unrecognized: %s.\n", input);
+    break;
+  case DB_PARAMETER_ERROR:
+    printf("input parameter is unbound: %s.\n", input);
+    break;
+  case DB_DUPLICATE_KEY:
+    printf("Error: Duplicate key.\n");
+    break;
+  case DB_NOT_FOUND:
+    printf("Error: Not found.\n");
+    break;
+  case DB_DUPLICATE_INDEX:
+    printf("Error: Duplicate index.\n");
+    break;
+  case DB_FULL_TABLE:
+    printf("Table insertion is full!\n");
+    break;
+  case DB_IO_ERROR:
+    printf("Error: %s.\n", strerror(errno));
+    break;
+  }
+}
+// 批量模式每次从stdin 读入的最小字节数
+const uint32_t BATCH_READ_SIZE = 1 << 20;
+// 批量模式的一行: 空行跳过，出错时带上行号
+void batch_line(Table* table, char* line, uint32_t length,
+                uint32_t line_number) {
+  if (length > 0 && line[length - 1] == '\r') {
+    line[--length] = '\0';
+  }
+  if (length == 0) {
+    return;
+  }
+  if (line[0] == '.') {
+    InputBuffer input_buffer = {line, length + 1, length};
+    if (do_meta_command(&input_buffer, table) == META_COMMAND_UNRECOGNIZED) {
+      printf("line %d: unrecognize command: %s.\n", line_number, line);
+    }
+    return;
+  }
+  DBResult result = db_exec(table, line, NULL, NULL);
+  if (result != DB_OK) {
+    printf("line %d: ", line_number);
+    print_result(result, line, false);
+  }
+}
+// 批量模式: 不打印提示符和Executed.，整块读入stdin 后原地按行切分执行
+// 全部输入在一个事务中，结束时提交
+void run_batch(Table* table) {
+  size_t capacity = BATCH_READ_SIZE;
+  char* buffer = malloc(capacity);
+  // buffer 开头还没执行的字节数(上一块末尾不完整的行)
+  size_t length = 0;
+  uint32_t line_number = 0;
+  db_begin(table);
+  while (true) {
+    // 一行比缓冲还长时扩大缓冲，留一个字节给输入结束时补的换行符
+    if (capacity - length < BATCH_READ_SIZE / 2) {
+      capacity *= 2;
+      buffer = realloc(buffer, capacity);
+    }
+    ssize_t bytes_read = read(STDIN_FILENO, buffer + length, capacity - length - 1);
+    if (bytes_read == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printf("get user input error: %s.\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    length += bytes_read;
+    // 输入结束，最后一行可能没有换行符
+    bool done = bytes_read == 0;
+    if (done && length > 0) {
+      buffer[length++] = '\n';
+    }
+    char* line = buffer;
+    char* end = buffer + length;
+    char* newline;
+    while ((newline = memchr(line, '\n', end - line))) {
+      *newline = '\0';
+      batch_line(table, line, newline - line, ++line_number);
+      line = newline + 1;
+    }
+    length = end - line;
+    memmove(buffer, line, length);
+    if (done) {
+      break;
+    }
+  }
+  db_commit(table);
+  free(buffer);
+}
+// REPL: 读一行交给db_exec，select 的结果直接打印
+// --batch: 见run_batch
+int main(int argc, char** argv) {
+  char* filename = NULL;
+  bool batch = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--batch") == 0) {
+      batch = true;
+    } else {
+      filename = argv[i];
+    }
+  }
+  if (filename == NULL) {
+    printf("Must supply a database filename.\n");
+    exit(EXIT_FAILURE);
+  }
+  Table* table = db_open(filename);
+  if (batch) {
+    run_batch(table);
+    db_close(table);
+    return 0;
+  }
+  InputBuffer* input_buffer = new_input_buffer();
+  while (true) {
     printf("> ");
-    InputBuffer* input_buffer = new_input_buffer();
-    read_line(input_buffer);
+    if (!read_line(input_buffer)) {
+      break;
+    }
 
     // 对原字符进行识别是否有辅助指令
     if (input_buffer->buffer[0] == '.') {
@@ -693,38 +4332,15 @@ int main(int argc, char** argv) {
         continue;
       }
     }
-    Statement statement;
-    switch (prepare_statement(input_buffer, &statement)) {
-    case PREPARE_SUCCESS:
-      break;
-    case PREPARE_NEGATIVE_ID:
-      printf("input ID is negative: %s.\n", input_buffer->buffer);
-      continue;
-    case PREPARE_SYNTAX_ERROR:
-      printf("input syntax is error: %s.\n", input_buffer->buffer);
-      continue;
-    case PREPARE_STRING_TOO_LONG:
-      printf("input variable is too long: %s.\n", input_buffer->buffer);
-      continue;
-    case PREPARE_UNRECOGNIZED_STATEMENT:
-      printf("input unrecognized: %s.\n", input_buffer->buffer);
-      continue;
-    }
-    switch (execute_statement(&statement, table)) {
-    case EXECUTE_SUCCESS:
-      printf("Executed.\n");
-      break;
-    case EXECUTE_DUPLICATE_KEY:
-      printf("Error: Duplicate key.\n");
-      break;
-    case EXECUTE_FULL_TABLE:
-      printf("Table insertion is full!");
-      break;
-    }
-    del_input_buffer(input_buffer);
+    print_result(db_exec(table, input_buffer->buffer, NULL, NULL),
+                 input_buffer->buffer, true);
   }
+  // 输入结束与.exit 相同，保存后退出
+  del_input_buffer(input_buffer);
+  db_close(table);
   return 0;
 }
+#endif
 
 void pager_flush(Pager* pager, uint32_t page_num) {
   if (pager->pages[page_num] == NULL) {
@@ -744,8 +4360,39 @@ void pager_flush(Pager* pager, uint32_t page_num) {
     exit(EXIT_FAILURE);
   }
 }
+// 索引没有快照和版本，直接写回所有页面
+void index_close(Pager* pager) {
+  FORLESS(pager->num_pages) {
+    if (pager->pages[i] != NULL) {
+      pager_flush(pager, i);
+      free(pager->pages[i]);
+    }
+  }
+  if (close(pager->file_descriptor) == -1) {
+    printf("close file error: %s!\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_destroy(&pager->load_lock);
+  free(pager);
+}
 void db_close(Table* table) {
   Pager* pager = table->pager;
+  // 未提交的显式事务随关闭提交
+  if (table_owns_transaction(table)) {
+    db_commit(table);
+  }
+  // 归还还未释放的快照，旧缓冲随之回收
+  while (table->snapshots) {
+    table_release_snapshot(table->snapshots);
+  }
+  pager_reclaim(pager);
+  // 冻结内存中叶子的版本，下次打开时事务号重新开始
+  uint32_t horizon = atomic_load(&table->committed_txn_id);
+  FORLESS(pager->num_pages) {
+    if (pager->pages[i] != NULL && get_node_type(pager->pages[i]) == NODE_LEAF) {
+      leaf_node_freeze(pager->pages[i], horizon);
+    }
+  }
   FORLESS(pager->num_pages) {
     if (pager->pages[i] != NULL) {
       pager_flush(pager, i);
@@ -763,9 +4410,333 @@ void db_close(Table* table) {
       pager->pages[i] = NULL;
     }
   }
+  FORLESS(2) {
+    if (table->indexes[i]) {
+      index_close(table->indexes[i]);
+    }
+  }
   del_table(table);
 }
 
+// .import csv|tsv <file>: 映射整个文件，按行边界切成块并行解析
+// 每块解析后按id 排序，归并后分批插入
+// 每行id,username,email，字段可以用双引号括起来(""表示一个引号，不能含换行)
+// 文件第一行id 不是数字时当作表头跳过
+const uint32_t IMPORT_MAX_REPORTED = 10;
+// 小于这个大小的文件不再切块
+const uint32_t IMPORT_MIN_CHUNK = 1 << 16;
+// 每批(一个事务)插入的行数
+const uint32_t IMPORT_BATCH_ROWS = 256;
+
+typedef struct {
+  Row row;
+  // 块内行号，报告时加上前面块的行数
+  uint32_t line;
+} ImportRow;
+
+typedef struct {
+  uint32_t line;
+  const char* reason;
+} ImportReject;
+
+// 一个解析块: [start, end) 从行首开始、到行尾结束
+typedef struct {
+  const char* start;
+  const char* end;
+  char delimiter;
+  bool first;
+  ImportRow* rows;
+  uint32_t num_rows;
+  uint32_t capacity;
+  uint32_t num_lines;
+  uint32_t num_rejects;
+  ImportReject rejects[IMPORT_MAX_REPORTED];
+} ImportChunk;
+
+// [p, end) 中第一个delimiter 的位置，没有时返回end
+// SSE2 下一次比较16 字节
+const char* import_scan(const char* p, const char* end, char delimiter) {
+#ifdef __SSE2__
+  __m128i target = _mm_set1_epi8(delimiter);
+  for (; p + 16 <= end; p += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, target));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+  while (p < end && *p != delimiter) {
+    p++;
+  }
+  return p;
+}
+// 解析一行中的一个字段复制到dest，返回字段后的分隔符位置或end
+// 出错时设置*reason
+const char* import_field(const char* p, const char* end, char delimiter,
+                         char* dest, uint32_t max_length,
+                         const char** reason) {
+  uint32_t length = 0;
+  if (p < end && *p == '"') {
+    p++;
+    while (true) {
+      if (p == end) {
+        *reason = "unterminated quote";
+        return p;
+      }
+      char c = *p++;
+      if (c == '"') {
+        if (p == end || *p != '"') {
+          break;
+        }
+        p++;
+      }
+      if (length == max_length) {
+        *reason = "value too long";
+        return p;
+      }
+      dest[length++] = c;
+    }
+    if (p < end && *p != delimiter) {
+      *reason = "text after closing quote";
+      return p;
+    }
+  } else {
+    const char* field_end = import_scan(p, end, delimiter);
+    length = field_end - p;
+    if (length > max_length) {
+      *reason = "value too long";
+      return field_end;
+    }
+    memcpy(dest, p, length);
+    p = field_end;
+  }
+  dest[length] = '\0';
+  return p;
+}
+// 解析一行(不含换行符)，成功返回NULL，否则返回拒绝原因
+const char* import_parse_line(const char* p, const char* end, char delimiter,
+                              Row* row) {
+  const char* field_end = import_scan(p, end, delimiter);
+  if (field_end == end) {
+    return "wrong number of columns";
+  }
+  Token id = {p, field_end - p};
+  PrepareResult result = token_to_uint32(&id, &row->id);
+  if (result == PREPARE_NEGATIVE_ID) {
+    return "negative id";
+  }
+  if (result != PREPARE_SUCCESS) {
+    return "bad id";
+  }
+  const char* reason = NULL;
+  p = import_field(field_end + 1, end, delimiter, row->username,
+                   COLUMN_USERNAME, &reason);
+  if (reason) {
+    return reason;
+  }
+  if (p == end) {
+    return "wrong number of columns";
+  }
+  p = import_field(p + 1, end, delimiter, row->email, COLUMN_EMAIL, &reason);
+  if (reason) {
+    return reason;
+  }
+  if (p != end) {
+    return "wrong number of columns";
+  }
+  return NULL;
+}
+void import_reject(ImportChunk* chunk, uint32_t line, const char* reason) {
+  if (chunk->num_rejects < IMPORT_MAX_REPORTED) {
+    chunk->rejects[chunk->num_rejects].line = line;
+    chunk->rejects[chunk->num_rejects].reason = reason;
+  }
+  chunk->num_rejects++;
+}
+int import_row_compare(const void* a, const void* b) {
+  uint32_t a_id = ((ImportRow*)a)->row.id;
+  uint32_t b_id = ((ImportRow*)b)->row.id;
+  if (a_id != b_id) {
+    return a_id < b_id ? -1 : 1;
+  }
+  // 重复的id 保留文件中靠前的那行
+  return ((ImportRow*)a)->line < ((ImportRow*)b)->line ? -1 : 1;
+}
+void* import_worker(void* arg) {
+  ImportChunk* chunk = arg;
+  const char* p = chunk->start;
+  while (p < chunk->end) {
+    const char* line_end = memchr(p, '\n', chunk->end - p);
+    if (line_end == NULL) {
+      line_end = chunk->end;
+    }
+    const char* next = line_end + 1;
+    uint32_t line = ++chunk->num_lines;
+    if (line_end > p && line_end[-1] == '\r') {
+      line_end--;
+    }
+    if (line_end == p) {
+      p = next;
+      continue;
+    }
+    if (chunk->num_rows == chunk->capacity) {
+      chunk->capacity = chunk->capacity ? chunk->capacity * 2 : 1024;
+      chunk->rows = realloc(chunk->rows, chunk->capacity * sizeof(ImportRow));
+    }
+    ImportRow* row = &chunk->rows[chunk->num_rows];
+    const char* reason =
+        import_parse_line(p, line_end, chunk->delimiter, &row->row);
+    if (reason == NULL) {
+      row->line = line;
+      chunk->num_rows++;
+    } else if (!(chunk->first && line == 1 && *p != '-' &&
+                 (*p < '0' || *p > '9'))) {
+      import_reject(chunk, line, reason);
+    }
+    p = next;
+  }
+  qsort(chunk->rows, chunk->num_rows, sizeof(ImportRow), import_row_compare);
+  return NULL;
+}
+// 从各块中取出id 最小的一行，都取完时返回NULL
+ImportRow* import_next_row(ImportChunk* chunks, uint32_t num_chunks,
+                           uint32_t* positions, uint32_t* chunk_index) {
+  ImportRow* smallest = NULL;
+  FORLESS(num_chunks) {
+    if (positions[i] == chunks[i].num_rows) {
+      continue;
+    }
+    ImportRow* row = &chunks[i].rows[positions[i]];
+    if (smallest == NULL || row->row.id < smallest->row.id) {
+      smallest = row;
+      *chunk_index = i;
+    }
+  }
+  if (smallest) {
+    positions[*chunk_index]++;
+  }
+  return smallest;
+}
+// 按id 顺序每IMPORT_BATCH_ROWS 行作为一批插入，批内同一个叶子的行只下降一次
+// 批之间释放写锁让其他写者进来
+void import_insert(Table* table, ImportChunk* chunks, uint32_t num_chunks,
+                   uint32_t* line_bases, uint32_t* imported) {
+  uint32_t positions[num_chunks];
+  memset(positions, 0, sizeof(positions));
+  Row* rows = malloc(IMPORT_BATCH_ROWS * sizeof(Row));
+  uint32_t lines[IMPORT_BATCH_ROWS];
+  ExecuteResult results[IMPORT_BATCH_ROWS];
+  uint32_t chunk_index;
+  ImportRow* row = import_next_row(chunks, num_chunks, positions, &chunk_index);
+  while (row) {
+    uint32_t num_rows = 0;
+    for (; row && num_rows < IMPORT_BATCH_ROWS; num_rows++) {
+      rows[num_rows] = row->row;
+      // 行号换算成文件中的行号
+      lines[num_rows] = line_bases[chunk_index] + row->line;
+      row = import_next_row(chunks, num_chunks, positions, &chunk_index);
+    }
+    table_insert_batch(table, rows, num_rows, results, imported);
+    // 重复和表满的行记在第一块里统一报告
+    FORLESS(num_rows) {
+      if (results[i] == EXECUTE_DUPLICATE_KEY) {
+        import_reject(&chunks[0], lines[i], "duplicate id");
+      } else if (results[i] == EXECUTE_FULL_TABLE) {
+        import_reject(&chunks[0], lines[i], "table full");
+      }
+    }
+  }
+  free(rows);
+}
+DBResult db_import(DB* table, const char* filename, char delimiter,
+                   uint32_t* imported, uint32_t* rejected,
+                   DBRejectCallback on_reject, void* arg) {
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1) {
+    return DB_IO_ERROR;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  size_t size = st.st_size;
+  const char* data = NULL;
+  if (size > 0) {
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      int error = errno;
+      close(fd);
+      errno = error;
+      return DB_IO_ERROR;
+    }
+    madvise((void*)data, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+  }
+
+  // 块数与扫描线程数相同，块边界移到下一行行首
+  uint32_t num_chunks = table->scan_threads;
+  if (num_chunks > size / IMPORT_MIN_CHUNK) {
+    num_chunks = size / IMPORT_MIN_CHUNK > 0 ? size / IMPORT_MIN_CHUNK : 1;
+  }
+  ImportChunk chunks[num_chunks];
+  pthread_t threads[num_chunks];
+  memset(chunks, 0, sizeof(chunks));
+  const char* end = data + size;
+  const char* start = data;
+  FORLESS(num_chunks) {
+    const char* chunk_end = data + size / num_chunks * (i + 1);
+    if (i + 1 == num_chunks) {
+      chunk_end = end;
+    } else if (chunk_end < start) {
+      chunk_end = start;
+    } else {
+      const char* newline = memchr(chunk_end, '\n', end - chunk_end);
+      chunk_end = newline ? newline + 1 : end;
+    }
+    chunks[i].start = start;
+    chunks[i].end = chunk_end;
+    chunks[i].delimiter = delimiter;
+    chunks[i].first = i == 0;
+    start = chunk_end;
+    pthread_create(&threads[i], NULL, import_worker, &chunks[i]);
+  }
+  FORLESS(num_chunks) { pthread_join(threads[i], NULL); }
+
+  // 每块第一行在文件中的行号减1
+  uint32_t line_bases[num_chunks];
+  uint32_t num_lines = 0;
+  FORLESS(num_chunks) {
+    line_bases[i] = num_lines;
+    num_lines += chunks[i].num_lines;
+    for (uint32_t j = 0; j < chunks[i].num_rejects && j < IMPORT_MAX_REPORTED;
+         j++) {
+      chunks[i].rejects[j].line += num_lines - chunks[i].num_lines;
+    }
+  }
+  *imported = 0;
+  import_insert(table, chunks, num_chunks, line_bases, imported);
+
+  *rejected = 0;
+  uint32_t reported = 0;
+  FORLESS(num_chunks) {
+    *rejected += chunks[i].num_rejects;
+    for (uint32_t j = 0; j < chunks[i].num_rejects &&
+                         j < IMPORT_MAX_REPORTED && reported < IMPORT_MAX_REPORTED;
+         j++, reported++) {
+      if (on_reject) {
+        on_reject(arg, chunks[i].rejects[j].line, chunks[i].rejects[j].reason);
+      }
+    }
+    free(chunks[i].rows);
+  }
+  if (size > 0) {
+    munmap((void*)data, size);
+  }
+  close(fd);
+  return DB_OK;
+}
+void print_import_reject(void* arg, uint32_t line, const char* reason) {
+  printf("line %d: %s\n", line, reason);
+}
+
 MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
   // 模拟退出时保存数据
   if (strcmp(input_buffer->buffer, ".exit") == 0) {
@@ -779,6 +4750,40 @@ MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
     printf("Constants:\n");
     print_constants();
     return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".threads ", 9) == 0) {
+    // 全表扫描的并行度，1 为单线程扫描
+    int threads = atoi(input_buffer->buffer + 9);
+    db_set_threads(table, threads > 1 ? threads : 1);
+    return META_COMMAND_SUCCESS;
+  } else if (strcmp(input_buffer->buffer, ".stats") == 0) {
+    DBStats stats;
+    db_stats(table, &stats);
+    printf("Leaves scanned: %d, skipped by zone map: %d\n", stats.scan_leaves,
+           stats.scan_skipped_leaves);
+    printf("Plan cache hits: %d, misses: %d\n", stats.plan_cache_hits,
+           stats.plan_cache_misses);
+    return META_COMMAND_SUCCESS;
+  } else if (strncmp(input_buffer->buffer, ".import ", 8) == 0) {
+    Lexer lexer;
+    Token format, file, rest;
+    lexer_init(&lexer, input_buffer->buffer + 8, input_buffer->str_length - 8);
+    if (!lexer_next(&lexer, &format) || !lexer_next(&lexer, &file) ||
+        lexer_next(&lexer, &rest) ||
+        !(token_is(&format, "csv") || token_is(&format, "tsv"))) {
+      return META_COMMAND_UNRECOGNIZED;
+    }
+    char filename[file.length + 1];
+    memcpy(filename, file.start, file.length);
+    filename[file.length] = '\0';
+    uint32_t imported, rejected;
+    if (db_import(table, filename, token_is(&format, "csv") ? ',' : '\t',
+                  &imported, &rejected, print_import_reject,
+                  NULL) == DB_IO_ERROR) {
+      printf("import file: %s error: %s.\n", filename, strerror(errno));
+    } else {
+      printf("Imported %d rows, rejected %d.\n", imported, rejected);
+    }
+    return META_COMMAND_SUCCESS;
   }
   return META_COMMAND_UNRECOGNIZED;
 }
@@ -797,13 +4802,26 @@ Pager* pager_open(const char* filename) {
   }
   Pager* pager = malloc(sizeof(Pager));
   pager->file_descriptor = fd;
+  pager->write_set_size = 0;
+  pthread_mutex_init(&pager->load_lock, NULL);
+  pager->epoch = 1;
+  pager->cow_epoch = 0;
+  pager->oldest_epoch = 0;
+  pager->retired_pages = NULL;
+  pager->pages_read = 0;
+  atomic_init(&pager->read_phase, 1);
+  atomic_init(&pager->phase_readers[0], 0);
+  atomic_init(&pager->phase_readers[1], 0);
   pager->file_length = read_bytes;
   pager->num_pages = (read_bytes / PAGE_SIZE);
   if (read_bytes % PAGE_SIZE != 0) {
     printf("Db file is not a whole number of pages. Corrupt file.\n");
     exit(EXIT_FAILURE);
   }
-  FORLESS(TABLE_MAX_PAGES) { pager->pages[i] = NULL; }
+  FORLESS(TABLE_MAX_PAGES) {
+    atomic_init(&pager->pages[i], NULL);
+    atomic_init(&pager->page_versions[i], 0);
+  }
   return pager;
 }
 Table* db_open(const char* filename) {
@@ -813,6 +4831,34 @@ Table* db_open(const char* filename) {
   Table* table = malloc(sizeof(Table));
   table->pager = pager;
   table->root_page_num = 0;
+  pthread_mutex_init(&table->write_lock, NULL);
+  table->parent = NULL;
+  table->snapshot_epoch = 0;
+  table->snapshots = NULL;
+  table->next_snapshot = NULL;
+  table->next_txn_id = TXN_FROZEN + 1;
+  atomic_init(&table->committed_txn_id, TXN_FROZEN);
+  table->write_txn_id = TXN_NONE;
+  atomic_init(&table->in_transaction, false);
+  pthread_mutex_init(&table->readers_lock, NULL);
+  pthread_cond_init(&table->views_closed, NULL);
+  table->read_views = NULL;
+  atomic_init(&table->scan_threads, 1);
+  atomic_init(&table->scan_leaves, 0);
+  atomic_init(&table->scan_skipped_leaves, 0);
+  table->filename = strdup(filename);
+  memset(table->index_catchup, 0, sizeof(table->index_catchup));
+  atomic_init(&table->plan_version, 1);
+  table->plan_cache = calloc(1, sizeof(PlanCache));
+  pthread_mutex_init(&table->plan_cache->lock, NULL);
+  // 打开已经建过的索引
+  Projection columns[2] = {PROJECTION_USERNAME, PROJECTION_EMAIL};
+  FORLESS(2) {
+    char* index_file = index_filename(table, columns[i]);
+    table->indexes[i] = access(index_file, F_OK) == 0 ? pager_open(index_file)
+                                                      : NULL;
+    free(index_file);
+  }
 
   if (pager->num_pages == 0) {
     void* root_node = get_page(pager, 0);
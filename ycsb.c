@@ -0,0 +1,480 @@
+// YCSB 风格的混合负载: 先装载records 行，再由多个线程按工作负载A-F 的比例发请求
+//   A 读/更新 50/50，B 读/更新 95/5，C 只读，D 读/插入 95/5 并偏向最新插入的行，
+//   E 短范围扫描/插入 95/5，F 读/读改写 50/50
+// key 分布默认按YCSB: D 为latest，其余为zipfian(打散热点)，可以用-d 换成uniform 等
+// 输出JSON: 吞吐、每种操作的延迟分位数和直方图
+//   gcc -O2 -c -DDB_LIBRARY part8.c -o db.o
+//   gcc -O2 ycsb.c db.o -o ycsb -lpthread -lm
+//   ./ycsb [-w a-f] [-d uniform|zipfian|latest] [-t threads] [-r records]
+//          [-o operations] > result.json
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "db.h"
+
+#define YCSB_FILE "ycsb.db"
+
+// 内部节点不分裂，表最多100页: 装载和插入的总行数不超过这个上限，
+// 更新留下的旧版本也要占叶子空间，比bench_suite 的上限再留一些余量
+#define YCSB_MAX_ROWS 550
+// 扫描的行数在[1, YCSB_MAX_SCAN] 内均匀选择
+#define YCSB_MAX_SCAN 100
+#define YCSB_ZIPF_THETA 0.99
+// 延迟直方图: 每个2 的幂分成4 个桶，最大约2^41 纳秒
+#define HIST_SUB_BUCKETS 4
+#define HIST_BUCKETS 160
+
+typedef enum { OP_READ, OP_UPDATE, OP_INSERT, OP_SCAN, OP_RMW } YcsbOp;
+#define YCSB_OPS 5
+const char* op_names[YCSB_OPS] = {"read", "update", "insert", "scan",
+                                  "read_modify_write"};
+
+typedef enum { DIST_UNIFORM, DIST_ZIPFIAN, DIST_LATEST } Distribution;
+const char* distribution_names[] = {"uniform", "zipfian", "latest"};
+
+// 工作负载: 各操作的百分比和默认key 分布
+typedef struct {
+  char name;
+  uint32_t mix[YCSB_OPS];
+  Distribution distribution;
+} Workload;
+const Workload workloads[] = {
+    {'a', {50, 50, 0, 0, 0}, DIST_ZIPFIAN},
+    {'b', {95, 5, 0, 0, 0}, DIST_ZIPFIAN},
+    {'c', {100, 0, 0, 0, 0}, DIST_ZIPFIAN},
+    {'d', {95, 0, 5, 0, 0}, DIST_LATEST},
+    {'e', {0, 0, 5, 95, 0}, DIST_ZIPFIAN},
+    {'f', {50, 0, 0, 0, 50}, DIST_ZIPFIAN},
+};
+
+typedef struct {
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  // 读、更新和读改写没找到行，写入返回其他错误，扫描输出的行数
+  uint64_t not_found;
+  uint64_t failed;
+  uint64_t rows;
+  uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+// zipfian: Gray 等人的生成方法，zeta[n] 预先算到YCSB_MAX_ROWS
+// 插入后key 的个数变化，直接取对应的zeta[n]
+typedef struct {
+  double alpha;
+  double zeta[YCSB_MAX_ROWS + 1];
+} Zipf;
+
+typedef struct {
+  DB* db;
+  const Workload* workload;
+  Distribution distribution;
+  Zipf* zipf;
+  uint32_t operations;
+  // 下一个分配给插入的id
+  _Atomic uint32_t* next_id;
+  // [1, inserted] 的插入都已结束，读写只在这个范围里选key
+  // 插入失败的id 留下空洞，读到时记为not_found
+  _Atomic uint32_t* inserted;
+  // 表满后没有执行的插入，改为读或扫描
+  _Atomic uint32_t* inserts_capped;
+  uint64_t seed;
+  Histogram histograms[YCSB_OPS];
+} Worker;
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+// 每个线程自己的xorshift64*
+uint64_t random_next(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 2685821657736338717ull;
+}
+double random_unit(uint64_t* state) {
+  return (random_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+// FNV-1a，把zipfian 的排名打散到整个key 空间
+uint64_t fnv_hash(uint64_t value) {
+  uint64_t hash = 14695981039346656037ull;
+  for (int i = 0; i < 8; i++) {
+    hash = (hash ^ (value & 0xFF)) * 1099511628211ull;
+    value >>= 8;
+  }
+  return hash;
+}
+
+void zipf_init(Zipf* zipf) {
+  zipf->alpha = 1.0 / (1.0 - YCSB_ZIPF_THETA);
+  zipf->zeta[0] = 0;
+  for (uint32_t i = 1; i <= YCSB_MAX_ROWS; i++) {
+    zipf->zeta[i] = zipf->zeta[i - 1] + 1.0 / pow(i, YCSB_ZIPF_THETA);
+  }
+}
+// [0, n) 中的排名，0 最热
+uint32_t zipf_next(Zipf* zipf, uint32_t n, uint64_t* state) {
+  if (n < 2) {
+    return 0;
+  }
+  double zetan = zipf->zeta[n];
+  double eta = (1 - pow(2.0 / n, 1 - YCSB_ZIPF_THETA)) /
+               (1 - zipf->zeta[2] / zetan);
+  double u = random_unit(state);
+  double uz = u * zetan;
+  if (uz < 1.0) {
+    return 0;
+  }
+  if (uz < 1.0 + pow(0.5, YCSB_ZIPF_THETA)) {
+    return 1;
+  }
+  uint32_t rank = n * pow(eta * u - eta + 1, zipf->alpha);
+  return rank < n ? rank : n - 1;
+}
+// 按分布在已有的id [1, n] 中选一个
+uint32_t worker_key(Worker* worker, uint32_t n) {
+  switch (worker->distribution) {
+  case DIST_UNIFORM:
+    return random_next(&worker->seed) % n + 1;
+  case DIST_ZIPFIAN:
+    return fnv_hash(zipf_next(worker->zipf, n, &worker->seed)) % n + 1;
+  case DIST_LATEST:
+    return n - zipf_next(worker->zipf, n, &worker->seed);
+  }
+  return 1;
+}
+
+uint32_t hist_bucket(uint64_t ns) {
+  if (ns < HIST_SUB_BUCKETS) {
+    return ns;
+  }
+  uint32_t exponent = 63 - __builtin_clzll(ns);
+  uint32_t sub = (ns >> (exponent - 2)) & (HIST_SUB_BUCKETS - 1);
+  uint32_t bucket = HIST_SUB_BUCKETS * (exponent - 1) + sub;
+  return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+// 桶内最大的纳秒数
+uint64_t hist_bucket_upper(uint32_t bucket) {
+  if (bucket < HIST_SUB_BUCKETS) {
+    return bucket;
+  }
+  uint32_t exponent = bucket / HIST_SUB_BUCKETS + 1;
+  uint64_t sub = bucket % HIST_SUB_BUCKETS;
+  uint64_t lower = (HIST_SUB_BUCKETS + sub) << (exponent - 2);
+  return lower + (1ull << (exponent - 2)) - 1;
+}
+void hist_record(Histogram* hist, uint64_t ns) {
+  hist->count++;
+  hist->total_ns += ns;
+  if (ns > hist->max_ns) {
+    hist->max_ns = ns;
+  }
+  hist->buckets[hist_bucket(ns)]++;
+}
+void hist_merge(Histogram* into, Histogram* from) {
+  into->count += from->count;
+  into->total_ns += from->total_ns;
+  into->not_found += from->not_found;
+  into->failed += from->failed;
+  into->rows += from->rows;
+  if (from->max_ns > into->max_ns) {
+    into->max_ns = from->max_ns;
+  }
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    into->buckets[i] += from->buckets[i];
+  }
+}
+// 分位数取所在桶的上界
+uint64_t hist_percentile(Histogram* hist, double p) {
+  uint64_t rank = (uint64_t)ceil(p * hist->count);
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= rank && seen > 0) {
+      uint64_t upper = hist_bucket_upper(i);
+      return upper < hist->max_ns ? upper : hist->max_ns;
+    }
+  }
+  return hist->max_ns;
+}
+
+typedef struct {
+  uint32_t remaining;
+  uint64_t rows;
+} ScanCount;
+bool scan_row(void* arg, const DBRowView* row) {
+  ScanCount* scan = arg;
+  scan->rows++;
+  return --scan->remaining > 0;
+}
+void make_row(DBRow* row, uint32_t id, uint64_t version) {
+  row->id = id;
+  snprintf(row->username, sizeof(row->username), "user%u", id);
+  snprintf(row->email, sizeof(row->email), "user%u.%llu@example.com", id,
+           (unsigned long long)version);
+}
+
+// 写入的结果记到直方图
+void hist_result(Histogram* hist, DBResult result) {
+  if (result == DB_NOT_FOUND) {
+    hist->not_found++;
+  } else if (result != DB_OK) {
+    hist->failed++;
+  }
+}
+// id 的插入结束后推进inserted: 分到更小id 的插入还没结束时等它
+void worker_publish(Worker* worker, uint32_t id) {
+  uint32_t expected = id - 1;
+  while (!atomic_compare_exchange_weak(worker->inserted, &expected, id)) {
+    expected = id - 1;
+    sched_yield();
+  }
+}
+// 按工作负载的比例选操作
+YcsbOp worker_pick(Worker* worker) {
+  uint32_t dice = random_next(&worker->seed) % 100;
+  for (int op = 0; op < YCSB_OPS; op++) {
+    if (dice < worker->workload->mix[op]) {
+      return op;
+    }
+    dice -= worker->workload->mix[op];
+  }
+  return OP_READ;
+}
+void* worker_run(void* arg) {
+  Worker* worker = arg;
+  DB* db = worker->db;
+  // 更新只改email，走update set 的单次下降
+  DBStatement* update;
+  if (db_prepare(db, "update set email = ? where id = ?", &update) != DB_OK) {
+    fprintf(stderr, "prepare update failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (uint32_t i = 0; i < worker->operations; i++) {
+    YcsbOp op = worker_pick(worker);
+    uint32_t n = atomic_load(worker->inserted);
+    uint32_t id = 0;
+    if (op == OP_INSERT) {
+      id = atomic_fetch_add(worker->next_id, 1);
+      if (id > YCSB_MAX_ROWS) {
+        atomic_fetch_add(worker->inserts_capped, 1);
+        op = worker->workload->mix[OP_SCAN] > 0 ? OP_SCAN : OP_READ;
+      }
+    }
+    if (op != OP_INSERT) {
+      id = worker_key(worker, n);
+    }
+    Histogram* hist = &worker->histograms[op];
+    DBRow row;
+    uint64_t start = now_ns();
+    switch (op) {
+    case OP_READ:
+      hist->not_found += !db_get(db, id, &row);
+      break;
+    case OP_UPDATE:
+    case OP_RMW:
+      if (op == OP_RMW && !db_get(db, id, &row)) {
+        hist->not_found++;
+        break;
+      }
+      make_row(&row, id, random_next(&worker->seed));
+      db_bind_text(update, 1, row.email);
+      db_bind_int(update, 2, id);
+      hist_result(hist, db_execute(db, update, NULL, NULL));
+      break;
+    case OP_INSERT:
+      make_row(&row, id, 0);
+      hist_result(hist, db_put(db, id, row.username, row.email));
+      break;
+    case OP_SCAN: {
+      ScanCount scan = {random_next(&worker->seed) % YCSB_MAX_SCAN + 1, 0};
+      db_scan(db, id, UINT32_MAX, scan_row, &scan);
+      hist->rows += scan.rows;
+      break;
+    }
+    }
+    hist_record(hist, now_ns() - start);
+    if (op == OP_INSERT) {
+      worker_publish(worker, id);
+    }
+  }
+  db_finalize(update);
+  return NULL;
+}
+
+void print_histogram(const char* name, Histogram* hist, bool last) {
+  printf("    \"%s\": {\"count\": %llu, \"avg_ns\": %.0f, \"p50_ns\": %llu, "
+         "\"p95_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, "
+         "\"max_ns\": %llu, \"not_found\": %llu, \"failed\": %llu, "
+         "\"rows\": %llu,\n",
+         name, (unsigned long long)hist->count,
+         hist->count ? (double)hist->total_ns / hist->count : 0.0,
+         (unsigned long long)hist_percentile(hist, 0.5),
+         (unsigned long long)hist_percentile(hist, 0.95),
+         (unsigned long long)hist_percentile(hist, 0.99),
+         (unsigned long long)hist_percentile(hist, 0.999),
+         (unsigned long long)hist->max_ns,
+         (unsigned long long)hist->not_found, (unsigned long long)hist->failed,
+         (unsigned long long)hist->rows);
+  // 只输出非空的桶: [桶上界纳秒, 次数]
+  printf("      \"histogram\": [");
+  bool first = true;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    if (hist->buckets[i] > 0) {
+      printf("%s[%llu, %llu]", first ? "" : ", ",
+             (unsigned long long)hist_bucket_upper(i),
+             (unsigned long long)hist->buckets[i]);
+      first = false;
+    }
+  }
+  printf("]}%s\n", last ? "" : ",");
+}
+
+void usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [-w a-f] [-d uniform|zipfian|latest] [-t threads] "
+          "[-r records] [-o operations]\n",
+          program);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+  const Workload* workload = &workloads[0];
+  int distribution = -1;
+  uint32_t threads = 4;
+  uint32_t records = 400;
+  uint32_t operations = 100000;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:d:t:r:o:")) != -1) {
+    switch (opt) {
+    case 'w':
+      if (optarg[0] < 'a' || optarg[0] > 'f' || optarg[1] != '\0') {
+        usage(argv[0]);
+      }
+      workload = &workloads[optarg[0] - 'a'];
+      break;
+    case 'd':
+      for (int i = DIST_UNIFORM; i <= DIST_LATEST; i++) {
+        if (strcmp(optarg, distribution_names[i]) == 0) {
+          distribution = i;
+        }
+      }
+      if (distribution < 0) {
+        usage(argv[0]);
+      }
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'r':
+      records = atoi(optarg);
+      break;
+    case 'o':
+      operations = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (threads == 0 || records == 0) {
+    usage(argv[0]);
+  }
+  if (records > YCSB_MAX_ROWS) {
+    fprintf(stderr, "records %u exceeds the table limit, using %u.\n",
+            records, YCSB_MAX_ROWS);
+    records = YCSB_MAX_ROWS;
+  }
+  if (distribution < 0) {
+    distribution = workload->distribution;
+  }
+
+  // 装载: 按id 顺序成批插入
+  unlink(YCSB_FILE);
+  DB* db = db_open(YCSB_FILE);
+  uint64_t load_start = now_ns();
+  DBRow* rows = malloc(records * sizeof(DBRow));
+  for (uint32_t i = 0; i < records; i++) {
+    make_row(&rows[i], i + 1, 0);
+  }
+  if (db_put_batch(db, rows, records, NULL) != DB_OK) {
+    fprintf(stderr, "load failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  free(rows);
+  uint64_t load_ns = now_ns() - load_start;
+
+  Zipf* zipf = malloc(sizeof(Zipf));
+  zipf_init(zipf);
+  _Atomic uint32_t next_id = records + 1;
+  _Atomic uint32_t inserted = records;
+  _Atomic uint32_t inserts_capped = 0;
+  Worker* workers = calloc(threads, sizeof(Worker));
+  pthread_t* tids = malloc(threads * sizeof(pthread_t));
+  uint64_t run_start = now_ns();
+  for (uint32_t i = 0; i < threads; i++) {
+    Worker* worker = &workers[i];
+    worker->db = db;
+    worker->workload = workload;
+    worker->distribution = distribution;
+    worker->zipf = zipf;
+    // 余数分给前面的线程
+    worker->operations = operations / threads + (i < operations % threads);
+    worker->next_id = &next_id;
+    worker->inserted = &inserted;
+    worker->inserts_capped = &inserts_capped;
+    worker->seed = fnv_hash(i + 1);
+    pthread_create(&tids[i], NULL, worker_run, worker);
+  }
+  for (uint32_t i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  uint64_t run_ns = now_ns() - run_start;
+
+  Histogram total[YCSB_OPS];
+  memset(total, 0, sizeof(total));
+  for (uint32_t i = 0; i < threads; i++) {
+    for (int op = 0; op < YCSB_OPS; op++) {
+      hist_merge(&total[op], &workers[i].histograms[op]);
+    }
+  }
+  DBStats stats;
+  db_stats(db, &stats);
+  db_close(db);
+  unlink(YCSB_FILE);
+
+  printf("{\n  \"workload\": \"%c\", \"distribution\": \"%s\", "
+         "\"threads\": %u, \"records\": %u, \"operations\": %u,\n",
+         workload->name, distribution_names[distribution], threads, records,
+         operations);
+  printf("  \"load_seconds\": %.6f, \"run_seconds\": %.6f, "
+         "\"ops_per_sec\": %.0f, \"inserts_capped\": %u, "
+         "\"num_pages\": %u,\n",
+         load_ns / 1e9, run_ns / 1e9, operations / (run_ns / 1e9),
+         atomic_load(&inserts_capped), stats.num_pages);
+  printf("  \"ops\": {\n");
+  int last_op = -1;
+  for (int op = 0; op < YCSB_OPS; op++) {
+    if (total[op].count > 0) {
+      last_op = op;
+    }
+  }
+  for (int op = 0; op < YCSB_OPS; op++) {
+    if (total[op].count > 0) {
+      print_histogram(op_names[op], &total[op], op == last_op);
+    }
+  }
+  printf("  }\n}\n");
+  free(zipf);
+  free(workers);
+  free(tids);
+  return 0;
+}